@@ -1,32 +1,195 @@
 #ifndef CARROT_PLANNER_H_
 #define CARROT_PLANNER_H_
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <vector>
+#include <deque>
+#include <limits>
+#include <boost/atomic.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/shared_ptr.hpp>
 #include <geometry_msgs/Twist.h>
 #include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PolygonStamped.h>
 #include <tf/transform_datatypes.h>
 #include <tf/transform_listener.h>
 #include <visualization_msgs/Marker.h>
 #include <sensor_msgs/LaserScan.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <std_msgs/Float64MultiArray.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <nav_msgs/Odometry.h>
+
+#include "tue_carrot_planner/distance_transform.h"
+#include "tue_carrot_planner/velocity_obstacles.h"
+#include "tue_carrot_planner/scan_ring.h"
 
 class CarrotPlanner
 {
 
 public:
 
+    //! Obstacle in the laser scan: a run of adjacent beams without range jumps, in the laser frame
+    struct ObstacleCluster {
+        int first_beam;
+        int last_beam;
+        int nearest_beam;
+        double nearest_range;
+        double centroid_x;
+        double centroid_y;
+        double extent;
+    };
+
+    //! Reasons why the last command was limited, as a bitmask
+    enum LimitReason {
+        REASON_NONE = 0,
+        REASON_VIRTUAL_WALL = 1 << 0,       //!< Laser obstacle inside the virtual wall
+        REASON_COSTMAP = 1 << 1,            //!< Costmap obstacle in the corridor
+        REASON_ROTATE_ONLY = 1 << 2,        //!< Path blocked, only rotating
+        REASON_BLOCKED_NO_ROTATE = 1 << 3,  //!< Path blocked and rotating is not allowed
+        REASON_ACC_LIMIT = 1 << 4,          //!< Translational acceleration limit
+        REASON_STARTUP_RAMP = 1 << 5,       //!< Startup ramp after a freeze
+        REASON_GOAL_DISTANCE = 1 << 6,      //!< Slowing down near the goal
+        REASON_MAX_VEL = 1 << 7,            //!< At the maximum translational velocity
+        REASON_INVALID_FRAME = 1 << 8,      //!< Goal in the wrong frame
+        REASON_NO_LASER = 1 << 9,           //!< No laser data
+        REASON_OVERRIDE = 1 << 10,          //!< Command replaced by an override input
+        REASON_PROTECTIVE_STOP = 1 << 11,   //!< Protective stop from the laser callback
+        REASON_VELOCITY_OBSTACLE = 1 << 12, //!< Velocity changed to avoid moving obstacles
+        REASON_SPEED_ZONE = 1 << 13,        //!< Capped by the speed zone of the current position
+        REASON_LATERAL_ACC = 1 << 14        //!< Translation or rotation lowered to limit the centripetal acceleration
+    };
+
     CarrotPlanner(const std::string &name, double max_vel_lin = 0.75, double max_vel_rot = 0.4, double dist_wall = 0.65, bool allow_rotate_only = true);
 
     ~CarrotPlanner();
 
     bool MoveToGoal(geometry_msgs::PoseStamped &goal);
 
+    //! Same as above, but with the control cycle driven by the given time instead of the ROS clock. The first call
+    //! starts the clock, so a sequence of calls gives the same commands whenever it is run.
+    bool MoveToGoal(geometry_msgs::PoseStamped &goal, const ros::Time& now);
+
+    //! Command of the last publication, by the planner or an override input
+    geometry_msgs::Twist getPublishedCommand() const {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        return published_cmd_vel_;
+    }
+
+    //! Stop the robot; outranks override inputs for this command
     void freeze();
 
+    //! Hand a goal to the planner's own control cycle (control_rate > 0). Safe to call from any thread, never blocks:
+    //! only the latest goal is kept. Do not mix with calling MoveToGoal directly.
+    //! The cycle runs on its own callback queue and thread; the other public functions and the callbacks are serialized
+    //! with it by a mutex, so the node may use a multi-threaded spinner.
+    void submitGoal(const geometry_msgs::PoseStamped& goal);
+
+    //! Change the robot radius at runtime, e.g. when carrying a tray. Safe to call from any thread.
+    void setRobotRadius(double radius);
+
+    //! Check whether the wedge towards angle_goal is free of obstacles closer than dist_wall for a robot of radius_robot.
+    //! Static, so recorded scans can be evaluated offline without constructing a planner.
+    static bool isClearLine(const sensor_msgs::LaserScan& scan, double angle_goal, double dist_wall, double radius_robot,
+                            int* blocking_beam = 0, double* blocking_distance = 0);
+
+    //! Same check on a bare range array, so callers holding scans in their own buffers need not copy them.
+    //! Static, so it can be called without constructing a planner (e.g. from bindings).
+    static bool isClearLine(const float* ranges, int num_readings, double angle_min, double angle_increment,
+                            double angle_goal, double dist_wall, double radius_robot,
+                            int* blocking_beam = 0, double* blocking_distance = 0);
+
+    //! Batch version: ranges holds num_scans consecutive scans of num_readings beams with the same geometry. The scans
+    //! are split over num_threads threads, 0 for one per core. Does not touch Python or ROS state, so bindings may call
+    //! it without holding their interpreter lock.
+    static void isClearLine(const float* ranges, int num_scans, int num_readings, double angle_min, double angle_increment,
+                            const double* angle_goals, double dist_wall, double radius_robot, bool* path_free,
+                            int num_threads = 1);
+
+    //! In docking mode the goal is refined against the dock face in the scan and approached with a dedicated profile
+    void setDocking(bool docking) {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        docking_ = docking;
+        dock_line_valid_ = false;
+        dock_reached_ = false;
+    }
+
+    //! Feed a scan directly instead of through the laser topic, e.g. from a simulation (see the simulation parameter)
+    void setLaserScan(const sensor_msgs::LaserScan::ConstPtr& laser_scan);
+
+    //! Distance between the robot edge and the nearest obstacle in the latest scan
+    double getMinimumClearance() const;
+
+    //! Obstacles in the latest scan
+    std::vector<ObstacleCluster> getObstacles() const {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        return obstacles_;
+    }
+
+    //! Limiting reasons of the last cycle, with the beam index and distance of the blocking obstacle (-1 if none).
+    //! Also published each cycle on limit_reasons as [reasons, beam, distance].
+    unsigned int getLimitReasons(int& blocking_beam, double& blocking_distance) const {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        blocking_beam = blocking_beam_;
+        blocking_distance = blocking_distance_;
+        return limit_reasons_;
+    }
+
+    //! Wall time from construction to the first published non-zero command, -1 if there was none yet
+    double getTimeToFirstCommand() const {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        return time_to_first_command_;
+    }
+
+    //! True if the rotational command flipped sign more than max_sign_flips times within oscillation_window
+    bool isOscillating() const {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        return (int)flip_times_.size() > MAX_SIGN_FLIPS;
+    }
+
+    //! True if the path has been blocked for longer than deadlock_timeout
+    bool isDeadlocked() const {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        return deadlocked_;
+    }
+
 private:
 
+    void controlCycle(const ros::TimerEvent& event);
+
+    void stop(bool allow_override, const ros::Time& now);
+
+    void footprintCallBack(const geometry_msgs::PolygonStamped::ConstPtr& footprint);
+
+    void updateKpis(const geometry_msgs::Twist& cmd_vel, const ros::Time& now);
+
+    void publishKpis(const ros::TimerEvent& event);
+
+    struct Kpi;
+
+    void addKpiValues(const Kpi& kpi, const std::string& prefix, diagnostic_msgs::DiagnosticStatus& status);
+
+    bool loadKpis(const std::string& filename);
+
+    //! Write the KPIs to file; static, so it can run without holding the mutex
+    static bool saveKpis(const std::string& filename, const Kpi& kpi);
+
     bool setGoal(geometry_msgs::PoseStamped& goal);
 
-    bool computeVelocityCommand(geometry_msgs::Twist& cmd_vel);
+    void filterGoal();
+
+    bool refineDockingGoal();
+
+    bool fitDockLine(const tf::Vector3& center, double& nx, double& ny, double& d);
+
+    const sensor_msgs::LaserScan& scanWithoutDockFace(const sensor_msgs::LaserScan& scan);
+
+    bool propagateGoal(const geometry_msgs::PoseStamped& goal, geometry_msgs::PoseStamped& goal_now);
+
+    bool computeVelocityCommand(geometry_msgs::Twist& cmd_vel, const ros::Time& now);
 
     void setZeroVelocity(geometry_msgs::Twist& cmd_vel);
 
@@ -38,15 +201,77 @@ private:
 
     double determineReference(double error_x, double vel, double max_vel, double max_acc, double dt);
 
+    void limitLateralAcceleration(double dt, geometry_msgs::Twist& cmd_vel);
+
+    bool centerInPassage();
+
     bool isClearLine();
 
+    double desiredSpeed(double distance, double gain, double acc, double speed_limit, bool docking) const;
+
+    struct ShadowJob;
+
+    void submitShadowJob(const tf::Vector3& goal);
+
+    void shadowWorker();
+
+    void evaluateShadowConfigs(const ShadowJob& job);
+
+    std::string shadowSummary() const;
+
+    void publishVirtualWall(double angle_goal, ros::Publisher& pub);
+
     void laserScanCallBack(const sensor_msgs::LaserScan::ConstPtr& laser_scan);
 
+    void scanRingIngest();
+
+    int countChangedBlocks(const sensor_msgs::LaserScan& scan);
+
+    void segmentScan(const sensor_msgs::LaserScan& scan);
+
+    void publishObstacles(ros::Publisher& pub);
+
+    void trackObstacles(double time);
+
+    void avoidObstacles(double dt, geometry_msgs::Twist& cmd_vel);
+
+    void updateBeamTables(const sensor_msgs::LaserScan& scan);
+
+    bool isProtectiveFieldViolated(const sensor_msgs::LaserScan& scan, const geometry_msgs::Twist& cmd_vel) const;
+
+    bool checkProtectiveStop(const geometry_msgs::Twist& cmd_vel);
+
+    bool isClearCostmap(const DistanceTransform& dt, const nav_msgs::OccupancyGrid& info, const tf::Vector3& goal, double dist_wall) const;
+
+    void updateSpeedZoneLimit(const ros::Time& now);
+
+    void speedZoneCallBack(const nav_msgs::OccupancyGrid::ConstPtr& zones);
+
+    void costmapCallBack(const nav_msgs::OccupancyGrid::ConstPtr& costmap);
+
+    void monitorBehaviour(const geometry_msgs::Twist& cmd_vel, bool path_free, double time);
+
     double calculateHeading(const tf::Vector3& goal);
 
     void publishCarrot(const tf::Vector3& carrot, ros::Publisher& pub);
 
-    void publishCmdVel(const geometry_msgs::Twist& cmd_vel, ros::Publisher& pub);
+    void odomCallBack(const nav_msgs::Odometry::ConstPtr& odom);
+
+    void adaptAccelerationLimits(const geometry_msgs::Twist& cmd_vel, double time);
+
+    double adaptAcceleration(double acc, double acc_min, double acc_max, double acc_cmd, double acc_meas);
+
+    void publishLimitReasons();
+
+    //! Publish cmd_vel, or the active override input if allow_override; zero while the protective stop holds
+    void publishCmdVel(const geometry_msgs::Twist& cmd_vel, ros::Publisher& pub, const ros::Time& now, bool allow_override = true);
+
+    int activeOverride(const ros::Time& now) const;
+
+    //! Current time on the clock that drives the control cycle, for stamping inputs received between cycles
+    ros::Time clockNow() const;
+
+    void overrideCallBack(const geometry_msgs::Twist::ConstPtr& cmd_vel, size_t index);
 
     //! ROS parameters
     double MAX_VEL;
@@ -59,33 +284,263 @@ private:
     double DISTANCE_VIRTUAL_WALL;
     double RADIUS_ROBOT;
     double MIN_ANGLE_ZERO_TRANS;
+    double MAX_ACC_LATERAL;
+    double MAX_ACC_LIMIT;
+    double MAX_ACC_THETA_LIMIT;
+    double ACC_ADAPTATION_RATE;
+    double ACC_NOISE_FLOOR;
+    double OSCILLATION_WINDOW;
+    int MAX_SIGN_FLIPS;
+    double DEADLOCK_TIMEOUT;
+    double GOAL_FILTER_GAIN;
+    double GOAL_FILTER_JUMP;
+    double GOAL_FILTER_JUMP_ANGLE;
+    double PROTECTIVE_STOP_MARGIN;
+    double DOORWAY_MAX_WIDTH;
+    int SCAN_BLOCK_SIZE;
+    double SCAN_CHANGE_THRESHOLD;
+    double CLUSTER_BREAK_DISTANCE;
+    int MAX_OBSTACLES;
+    double VO_TIME_HORIZON;
+    double VO_RESPONSIBILITY;
+    double VO_RANGE;
+    double TRACK_MAX_EXTENT;
+    double TRACK_GATE;
+    double TRACK_VELOCITY_GAIN;
+    double DOCKING_STANDOFF;
+    double DOCKING_SEARCH_RADIUS;
+    double DOCKING_INLIER_DISTANCE;
+    int DOCKING_RANSAC_ITERATIONS;
+    int DOCKING_MIN_INLIERS;
+    double DOCKING_GAIN;
+    double DOCKING_MIN_VEL;
+    double DOCKING_TOLERANCE;
+    double DOCKING_ANGLE_TOLERANCE;
+
+    double GOAL_TIMEOUT;
+
+    //! Robot radius in use: RADIUS_ROBOT unless changed at runtime
+    boost::atomic<double> radius_robot_;
+    std::string footprint_topic_;
+    ros::Subscriber footprint_sub_;
+
+    //! Latest goal from submitGoal, exchanged atomically between producers and the control cycle
+    boost::atomic<geometry_msgs::PoseStamped*> latest_goal_;
+    geometry_msgs::PoseStamped submitted_goal_;
+    ros::Time t_submitted_goal_;
+    bool has_submitted_goal_;
+    ros::CallbackQueue control_queue_;
+    ros::AsyncSpinner* control_spinner_;
+    ros::Timer control_timer_;
+
+    //! Serializes the control cycle, the callbacks and the public functions (recursive: callbacks may freeze)
+    mutable boost::recursive_mutex mutex_;
+
+    //! Docking mode and the scan points near the dock face
+    bool docking_;
+    std::vector<float> dock_x_, dock_y_;
+
+    //! Dock face fitted in the current cycle (normal, offset and centre), and whether the dock is reached
+    bool dock_line_valid_;
+    double dock_nx_, dock_ny_, dock_d_, dock_face_x_, dock_face_y_;
+    bool dock_reached_;
+
+    //! Latest scan with the dock face beyond the standoff removed
+    sensor_msgs::LaserScan masked_scan_;
+    int COSTMAP_LETHAL_THRESHOLD;
+    double OVERRIDE_TIMEOUT;
+    double SPEED_ZONE_MAX_VEL;
+    double SPEED_ZONE_DEFAULT;
+    double SPEED_ZONE_TIMEOUT;
 
     //! Tracking frame and transform listener
     std::string tracking_frame_;
     tf::TransformListener* tf_listener_;
 
+    //! Propagate goals from their stamp to now using odometry in tf
+    bool propagate_goal_stamp_;
+    std::string odom_frame_;
+
     //! Goal position and angle
     tf::Vector3 goal_;
     double goal_angle_;
 
-    //! Timestamp and value of last time cmd_vel was published
+    //! Filtered goal in the odometry frame, to suppress perception noise
+    tf::Vector3 filtered_goal_;
+    double filtered_goal_angle_;
+    bool goal_filter_initialized_;
+
+    //! Timestamp and value of last time cmd_vel was published (timestamp 0 until the first cycle)
     double t_last_cmd_vel_;
     geometry_msgs::Twist last_cmd_vel_;
+    geometry_msgs::Twist published_cmd_vel_;
+
+    //! Clock of the latest cycle minus the ROS clock at that moment, zero when the cycle runs on the ROS clock
+    double clock_offset_;
     bool allow_rotate_only_;
     bool robot_did_move_;
     double scaling_factor_safety_;
 
+    //! Acceleration limits in use, adapted once per control cycle between MAX_ACC(_THETA) and MAX_ACC(_THETA)_LIMIT from odometry
+    double acc_lin_, acc_rot_;
+    std::string odom_topic_;
+    ros::Subscriber odom_sub_;
+
+    //! Latest odometry, the odometry at the previous cycle and the velocity change commanded in that cycle
+    geometry_msgs::Twist odom_vel_, cycle_odom_vel_, cmd_vel_change_;
+    double t_odom_, t_cycle_odom_, t_cycle_, dt_cmd_vel_change_;
+
+    //! Why the command of the current cycle is limited
+    unsigned int limit_reasons_;
+    int blocking_beam_;
+    double blocking_distance_;
+
+    //! Oscillation and deadlock monitoring
+    std::deque<double> flip_times_;
+    double last_angular_sign_;
+    double t_blocked_since_;
+    bool deadlocked_;
+
+    //! Outcome of the last clear-line check and the carrot it checked
+    bool path_free_;
+    tf::Vector3 carrot_checked_;
+
+    //! Candidate parameter sets evaluated on the same scans and goals without being actuated
+    struct ShadowConfig {
+        double dist_vir_wall;
+        double gain;
+        double max_acc;
+        unsigned int cycles;
+        unsigned int blocked;
+        unsigned int blocked_diff;
+        double speed_diff_sum;
+        double compute_time;
+        ShadowConfig() : dist_vir_wall(0), gain(0), max_acc(0), cycles(0), blocked(0), blocked_diff(0), speed_diff_sum(0), compute_time(0) {}
+    };
+    std::vector<ShadowConfig> shadow_configs_;
+
+    //! What the production configuration checked in a cycle, evaluated for the shadow configurations on their own thread
+    struct ShadowJob {
+        sensor_msgs::LaserScan::ConstPtr scan;                  //!< Scan with the dock face removed
+        tf::Vector3 goal;                                       //!< Requested goal, before centring and blocking
+        tf::Vector3 carrot;                                     //!< Carrot checked against the costmap
+        double goal_angle;
+        double radius_robot;
+        double speed_limit;
+        bool docking;
+        bool path_free;
+        double v_production;
+        boost::shared_ptr<const DistanceTransform> costmap_dt; //!< Null if production did not check the costmap
+        nav_msgs::OccupancyGrid costmap_info;
+    };
+
+    //! Only the latest job is kept: if the worker falls behind, cycles are skipped rather than queued
+    boost::thread* shadow_thread_;
+    boost::mutex shadow_mutex_;
+    boost::condition_variable shadow_cond_;
+    ShadowJob shadow_job_;
+    bool shadow_job_pending_;
+    bool shadow_stop_;
+    unsigned int shadow_skipped_;
+
+    //! Command inputs that take precedence over the planner while they are being received
+    struct OverrideInput {
+        std::string name;
+        ros::Subscriber sub;
+        geometry_msgs::Twist cmd_vel;
+        ros::Time stamp;
+    };
+    std::vector<OverrideInput> override_inputs_;
+
+    //! Operational KPIs: totals since the first run and the current publication window
+    struct Kpi {
+        double time;
+        double blocked_time;
+        double ramp_time;
+        double distance;
+        unsigned int freezes;
+        Kpi() : time(0), blocked_time(0), ramp_time(0), distance(0), freezes(0) {}
+    };
+    Kpi kpi_total_, kpi_window_;
+    ros::Time t_last_kpi_;
+    std::string kpi_file_;
+    ros::Publisher kpi_pub_;
+    ros::Timer kpi_timer_;
+
     //! Comminucation
-    ros::Publisher carrot_pub_, cmd_vel_pub_, virt_wall_pub_;
+    ros::Publisher carrot_pub_, cmd_vel_pub_, virt_wall_pub_, obstacles_pub_, limit_reasons_pub_;
     ros::Subscriber laser_scan_sub_;
 
-    //! Laser data
-    sensor_msgs::LaserScan laser_scan_;
+    //! Optional ingest of scans from a shared-memory ring written by a driver on the same host, instead of the topic
+    std::string scan_ring_name_;
+    double SCAN_RING_POLL_PERIOD;
+    double SCAN_RING_TIMEOUT;
+    boost::thread* scan_ring_thread_;
+    boost::atomic<bool> scan_ring_stop_;
+
+    //! Laser data, the message itself is shared instead of copied
+    sensor_msgs::LaserScan::ConstPtr laser_scan_;
     bool laser_data_available_;
 
+    //! Cosine and sine of every beam, rebuilt when the scanner geometry changes
+    std::vector<float> beam_cos_, beam_sin_;
+    float beam_angle_min_, beam_angle_increment_;
+
+    //! Steer towards the centre of narrow passages
+    bool doorway_centering_;
+
+    //! Scan from which the derived structures were built
+    sensor_msgs::LaserScan::ConstPtr reference_scan_;
+
+    //! Obstacles segmented from the latest scan, capacity reserved once
+    std::vector<ObstacleCluster> obstacles_;
+
+    //! Compact obstacles tracked over scans, with their estimated velocity in the robot frame and the time of their positions
+    struct TrackedObstacle {
+        double x, y;
+        double vx, vy;
+        double radius;
+    };
+    std::vector<TrackedObstacle> tracks_;
+    double t_last_tracks_;
+
+    //! Avoid moving obstacles with velocity obstacles, within the velocities the virtual wall allows
+    bool velocity_obstacle_avoidance_;
+    VelocityObstacles velocity_obstacles_;
+
+    //! Stop from within the laser callback if an obstacle enters the speed dependent stop field
+    bool protective_stop_;
+
+    //! The stop is latched until a scan newer than the one that triggered it shows the field clear
+    bool protective_stop_latched_;
+    sensor_msgs::LaserScan::ConstPtr protective_stop_scan_;
+
+    //! Speed zones: speed limit per cell, precomputed when the zones are received
+    std::string speed_zone_topic_;
+    ros::Subscriber speed_zone_sub_;
+    bool speed_zone_available_;
+    ros::Time t_speed_zones_;
+    std::vector<float> speed_zones_;
+    std::string speed_zone_frame_;
+    double speed_zone_resolution_;
+    int speed_zone_width_;
+    tf::Transform speed_zone_origin_inv_;
+    double speed_zone_limit_;
+
+    //! Costmap data: geometry of the last grid and its distance transform (copied on write while a shadow job holds it)
+    std::string costmap_topic_;
+    ros::Subscriber costmap_sub_;
+    nav_msgs::OccupancyGrid costmap_info_;
+    boost::shared_ptr<DistanceTransform> costmap_dt_;
+    bool costmap_available_;
+
     //! Visualization
     bool visualization_;
 
+    //! Startup timing
+    ros::WallTime t_construction_;
+    double time_to_first_command_;
+
 };
 
 #endif
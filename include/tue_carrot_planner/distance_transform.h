@@ -0,0 +1,52 @@
+#ifndef DISTANCE_TRANSFORM_H_
+#define DISTANCE_TRANSFORM_H_
+#include <vector>
+
+//! Euclidean distance transform of a binary grid (Felzenszwalb & Huttenlocher).
+//! The transform is separable: the column pass is cached and only redone for columns
+//! in which the occupancy changed, the row pass is redone for the whole grid.
+class DistanceTransform
+{
+
+public:
+
+    DistanceTransform();
+
+    //! Update with a new occupancy grid (row-major, width * height cells)
+    void update(const std::vector<bool>& occupied, int width, int height);
+
+    //! Distance in cells from cell (x, y) to the nearest occupied cell
+    float distance(int x, int y) const {
+        return distance_[y * width_ + x];
+    }
+
+    int width() const {
+        return width_;
+    }
+
+    int height() const {
+        return height_;
+    }
+
+private:
+
+    void transform1D(const float* f, int n, float* d);
+
+    int width_, height_;
+
+    //! Occupancy of the previous update, to find the changed columns
+    std::vector<bool> occupied_;
+
+    //! Squared distances after the column pass
+    std::vector<float> column_dt_;
+
+    //! Final distances in cells
+    std::vector<float> distance_;
+
+    //! Work buffers of transform1D
+    std::vector<float> f_, d_, z_;
+    std::vector<int> v_;
+
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef SCAN_DATASET_H_
+#define SCAN_DATASET_H_
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <boost/cstdint.hpp>
+#include <sensor_msgs/LaserScan.h>
+
+//! Recorded laser scans in a columnar binary file that is memory-mapped for offline evaluation. All scans of a file have
+//! the same number of readings. Layout, little-endian, every column starting at a multiple of 64 bytes:
+//!
+//!   header       ScanDatasetHeader
+//!   ranges       float32[num_scans][num_readings]
+//!   stamps       float64[num_scans]              seconds
+//!   angle_goals  float32[num_scans]              direction the robot was heading, rad in the laser frame
+//!   geometry     float32[num_scans][4]           angle_min, angle_increment, range_min, range_max
+//!
+//! The ranges come first so they can be streamed to disk while recording; the small columns follow when the file is
+//! closed, after which the header is rewritten with the final offsets.
+struct ScanDatasetHeader {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t num_readings;
+    boost::uint64_t num_scans;
+    boost::uint64_t ranges_offset;
+    boost::uint64_t stamps_offset;
+    boost::uint64_t angle_goals_offset;
+    boost::uint64_t geometry_offset;
+};
+
+class ScanDatasetWriter
+{
+
+public:
+
+    ScanDatasetWriter();
+
+    //! Closes the file if it is still open
+    ~ScanDatasetWriter();
+
+    bool open(const std::string& filename, int num_readings);
+
+    //! Append a scan; fails if its number of readings differs from that of the file
+    bool append(const sensor_msgs::LaserScan& scan, double angle_goal = 0);
+
+    //! Write the small columns and the final header
+    bool close();
+
+    boost::uint64_t numScans() const {
+        return stamps_.size();
+    }
+
+private:
+
+    FILE* file_;
+    int num_readings_;
+    std::vector<double> stamps_;
+    std::vector<float> angle_goals_;
+    std::vector<float> geometry_;
+
+};
+
+class ScanDatasetReader
+{
+
+public:
+
+    ScanDatasetReader();
+
+    ~ScanDatasetReader();
+
+    //! Map a file written by ScanDatasetWriter
+    bool open(const std::string& filename);
+
+    void close();
+
+    boost::uint64_t numScans() const {
+        return header_ ? header_->num_scans : 0;
+    }
+
+    int numReadings() const {
+        return header_ ? header_->num_readings : 0;
+    }
+
+    //! Ranges of all scans, one scan after the other
+    const float* ranges() const {
+        return reinterpret_cast<const float*>(memory_ + header_->ranges_offset);
+    }
+
+    const float* ranges(boost::uint64_t i) const {
+        return ranges() + i * header_->num_readings;
+    }
+
+    double stamp(boost::uint64_t i) const {
+        return reinterpret_cast<const double*>(memory_ + header_->stamps_offset)[i];
+    }
+
+    float angleGoal(boost::uint64_t i) const {
+        return reinterpret_cast<const float*>(memory_ + header_->angle_goals_offset)[i];
+    }
+
+    float angleMin(boost::uint64_t i) const {
+        return geometry(i)[0];
+    }
+
+    float angleIncrement(boost::uint64_t i) const {
+        return geometry(i)[1];
+    }
+
+    float rangeMin(boost::uint64_t i) const {
+        return geometry(i)[2];
+    }
+
+    float rangeMax(boost::uint64_t i) const {
+        return geometry(i)[3];
+    }
+
+private:
+
+    const float* geometry(boost::uint64_t i) const {
+        return reinterpret_cast<const float*>(memory_ + header_->geometry_offset) + 4 * i;
+    }
+
+    const char* memory_;
+    size_t size_;
+    const ScanDatasetHeader* header_;
+
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SCAN_RING_H_
+#define SCAN_RING_H_
+#include <string>
+#include <boost/cstdint.hpp>
+#include <sensor_msgs/LaserScan.h>
+
+//! Laser scans in a POSIX shared-memory ring, for a driver and a planner on the same host. The driver writes each scan
+//! once into the next slot; readers copy the newest slot out of the ring without locks. Every slot has a sequence
+//! counter that is odd while it is written (a seqlock), so a reader detects a slot that was overwritten during its copy
+//! and retries. There is a single writer per ring.
+class ScanRingWriter
+{
+
+public:
+
+    ScanRingWriter();
+
+    //! Removes the ring; readers keep their mapping until they reopen
+    ~ScanRingWriter();
+
+    //! Create ring /name with num_slots slots of at most max_readings ranges, replacing an existing ring of that name
+    bool create(const std::string& name, int num_slots, int max_readings);
+
+    //! Write a scan into the next slot
+    bool write(const sensor_msgs::LaserScan& scan);
+
+    //! Same as above, for drivers that do not build a message: the ranges are copied straight from the driver's buffer
+    bool write(const std_msgs::Header& header, float angle_min, float angle_increment, float time_increment, float scan_time,
+               float range_min, float range_max, const float* ranges, int num_readings);
+
+    //! Number of scans written since the ring was created
+    boost::uint64_t numWritten() const;
+
+private:
+
+    void close();
+
+    std::string name_;
+    char* memory_;
+    size_t size_;
+
+};
+
+class ScanRingReader
+{
+
+public:
+
+    ScanRingReader();
+
+    ~ScanRingReader();
+
+    //! Map an existing ring; fails if it does not exist (yet) or is not a scan ring
+    bool open(const std::string& name);
+
+    void close();
+
+    bool isOpen() const {
+        return memory_ != 0;
+    }
+
+    //! Copy of the newest scan if it was not read before, a null pointer otherwise
+    sensor_msgs::LaserScan::Ptr readLatest();
+
+    //! Scans that were overwritten before they were read
+    boost::uint64_t numSkipped() const {
+        return num_skipped_;
+    }
+
+private:
+
+    char* memory_;
+    size_t size_;
+
+    //! Scans written when the newest scan was read
+    boost::uint64_t num_read_;
+    boost::uint64_t num_skipped_;
+
+};
+
+#endif
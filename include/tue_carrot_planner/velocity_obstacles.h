@@ -0,0 +1,60 @@
+#ifndef VELOCITY_OBSTACLES_H_
+#define VELOCITY_OBSTACLES_H_
+#include <vector>
+#include <cstddef>
+
+//! Optimal reciprocal collision avoidance (van den Berg et al.) for a single robot, adapted from the
+//! RVO2 Library (Apache License 2.0, see velocity_obstacles.cpp and NOTICE).
+//! Every obstacle adds a half-plane of allowed velocities; solve() returns the velocity closest
+//! to the preferred one that satisfies all half-planes, found with a 2D incremental linear program.
+class VelocityObstacles
+{
+
+public:
+
+    struct Vector2 {
+        double x, y;
+        Vector2() : x(0), y(0) {}
+        Vector2(double x_, double y_) : x(x_), y(y_) {}
+    };
+
+    VelocityObstacles(double time_horizon = 2.0);
+
+    //! Start a new cycle for a robot with the given radius and current velocity
+    void reset(double radius, const Vector2& velocity, double dt);
+
+    //! Add a circular obstacle relative to the robot; responsibility is the share of the avoidance taken by the robot
+    void addObstacle(const Vector2& position, const Vector2& velocity, double radius, double responsibility);
+
+    //! Velocity closest to preferred with speed at most max_speed; returns false if no collision free velocity
+    //! exists, result is then the velocity that violates the constraints least
+    bool solve(const Vector2& preferred, double max_speed, Vector2& result) const;
+
+    void setTimeHorizon(double time_horizon) {
+        time_horizon_ = time_horizon;
+    }
+
+private:
+
+    struct Line {
+        Vector2 point;
+        Vector2 direction;
+    };
+
+    bool linearProgram1(const std::vector<Line>& lines, size_t line_no, double radius, const Vector2& opt_velocity,
+                        bool direction_opt, Vector2& result) const;
+
+    size_t linearProgram2(const std::vector<Line>& lines, double radius, const Vector2& opt_velocity,
+                          bool direction_opt, Vector2& result) const;
+
+    void linearProgram3(const std::vector<Line>& lines, size_t begin_line, double radius, Vector2& result) const;
+
+    double time_horizon_;
+    double radius_;
+    double dt_;
+    Vector2 velocity_;
+    std::vector<Line> lines_;
+
+};
+
+#endif
@@ -1,8 +1,16 @@
 #include "tue_carrot_planner/carrot_planner.h"
 
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
 CarrotPlanner::CarrotPlanner(const std::string &name, double max_vel_lin, double max_vel_rot, double dist_wall, bool allow_rotate_only) :
-    tracking_frame_("/amigo/base_link"), t_last_cmd_vel_(ros::Time::now().toSec()),
-    allow_rotate_only_(allow_rotate_only), robot_did_move_(false), scaling_factor_safety_(0.05), laser_data_available_(false), visualization_(true) {
+    latest_goal_(0), has_submitted_goal_(false), control_spinner_(0), docking_(false), dock_line_valid_(false), dock_reached_(false), tracking_frame_("/amigo/base_link"), filtered_goal_angle_(0), goal_filter_initialized_(false), t_last_cmd_vel_(0), clock_offset_(0),
+    allow_rotate_only_(allow_rotate_only), robot_did_move_(false), scaling_factor_safety_(0.05),
+    t_odom_(0), t_cycle_odom_(0), t_cycle_(0), dt_cmd_vel_change_(0),
+    limit_reasons_(REASON_NONE), blocking_beam_(-1), blocking_distance_(0), last_angular_sign_(0), t_blocked_since_(-1), deadlocked_(false), path_free_(true), shadow_thread_(0), shadow_job_pending_(false), shadow_stop_(false), shadow_skipped_(0), scan_ring_thread_(0), scan_ring_stop_(false), laser_data_available_(false), beam_angle_min_(0), beam_angle_increment_(0), t_last_tracks_(0), protective_stop_latched_(false), speed_zone_available_(false), speed_zone_resolution_(1), speed_zone_width_(1), costmap_dt_(new DistanceTransform()), costmap_available_(false), visualization_(true),
+    t_construction_(ros::WallTime::now()), time_to_first_command_(-1) {
 
     ros::NodeHandle private_nh("~/" + name);
 
@@ -16,43 +24,283 @@ CarrotPlanner::CarrotPlanner(const std::string &name, double max_vel_lin, double
     private_nh.param("max_angle", MAX_ANGLE, 1.0/2.0*3.14159);
     private_nh.param("dist_vir_wall", DISTANCE_VIRTUAL_WALL, dist_wall);
     private_nh.param("radius_robot", RADIUS_ROBOT, 0.5);
+    radius_robot_ = RADIUS_ROBOT;
     private_nh.param("min_angle_zero_trans", MIN_ANGLE_ZERO_TRANS, 10.0/180.0*3.14159);
+    private_nh.param("max_acc_lateral", MAX_ACC_LATERAL, 0.0);
+    private_nh.param("oscillation_window", OSCILLATION_WINDOW, 2.0);
+    private_nh.param("max_sign_flips", MAX_SIGN_FLIPS, 4);
+    private_nh.param("deadlock_timeout", DEADLOCK_TIMEOUT, 5.0);
+    private_nh.param("goal_filter_gain", GOAL_FILTER_GAIN, 1.0);
+    private_nh.param("goal_filter_jump", GOAL_FILTER_JUMP, 0.5);
+    private_nh.param("goal_filter_jump_angle", GOAL_FILTER_JUMP_ANGLE, 0.5);
+    private_nh.param("propagate_goal_stamp", propagate_goal_stamp_, false);
+    private_nh.param("odom_frame", odom_frame_, std::string("/amigo/odom"));
+    private_nh.param("doorway_centering", doorway_centering_, false);
+    private_nh.param("doorway_max_width", DOORWAY_MAX_WIDTH, 1.5);
+    private_nh.param("docking_standoff", DOCKING_STANDOFF, 0.1);
+    private_nh.param("docking_search_radius", DOCKING_SEARCH_RADIUS, 0.4);
+    private_nh.param("docking_inlier_distance", DOCKING_INLIER_DISTANCE, 0.01);
+    private_nh.param("docking_ransac_iterations", DOCKING_RANSAC_ITERATIONS, 50);
+    private_nh.param("docking_min_inliers", DOCKING_MIN_INLIERS, 10);
+    private_nh.param("docking_gain", DOCKING_GAIN, 1.0);
+    private_nh.param("docking_min_vel", DOCKING_MIN_VEL, 0.02);
+    private_nh.param("docking_tolerance", DOCKING_TOLERANCE, 0.005);
+    private_nh.param("docking_angle_tolerance", DOCKING_ANGLE_TOLERANCE, 0.01);
+    private_nh.param("odom_topic", odom_topic_, std::string(""));
+    private_nh.param("max_acc_translation_limit", MAX_ACC_LIMIT, MAX_ACC);
+    private_nh.param("max_acc_rotation_limit", MAX_ACC_THETA_LIMIT, MAX_ACC_THETA);
+    private_nh.param("acc_adaptation_rate", ACC_ADAPTATION_RATE, 0.01);
+    private_nh.param("acc_noise_floor", ACC_NOISE_FLOOR, 0.01);
+    acc_lin_ = MAX_ACC;
+    acc_rot_ = MAX_ACC_THETA;
+    private_nh.param("scan_block_size", SCAN_BLOCK_SIZE, 32);
+    private_nh.param("scan_change_threshold", SCAN_CHANGE_THRESHOLD, 0.02);
+    SCAN_BLOCK_SIZE = std::max(1, SCAN_BLOCK_SIZE);
+    private_nh.param("cluster_break_distance", CLUSTER_BREAK_DISTANCE, 0.1);
+    private_nh.param("max_obstacles", MAX_OBSTACLES, 64);
+    obstacles_.reserve(MAX_OBSTACLES);
+    private_nh.param("velocity_obstacle_avoidance", velocity_obstacle_avoidance_, false);
+    private_nh.param("vo_time_horizon", VO_TIME_HORIZON, 2.0);
+    private_nh.param("vo_responsibility", VO_RESPONSIBILITY, 0.5);
+    private_nh.param("vo_range", VO_RANGE, 3.0);
+    private_nh.param("track_max_extent", TRACK_MAX_EXTENT, 1.0);
+    private_nh.param("track_gate", TRACK_GATE, 0.5);
+    private_nh.param("track_velocity_gain", TRACK_VELOCITY_GAIN, 0.3);
+    velocity_obstacles_.setTimeHorizon(VO_TIME_HORIZON);
+    private_nh.param("protective_stop", protective_stop_, false);
+    private_nh.param("protective_stop_margin", PROTECTIVE_STOP_MARGIN, 0.1);
+    private_nh.param("costmap_topic", costmap_topic_, std::string(""));
+    private_nh.param("costmap_lethal_threshold", COSTMAP_LETHAL_THRESHOLD, 100);
+
+    //! Shadow configurations: entry i of each list forms one candidate, missing entries use the values above
+    std::vector<double> shadow_dist_wall, shadow_gain, shadow_max_acc;
+    private_nh.param("shadow_dist_vir_wall", shadow_dist_wall, std::vector<double>());
+    private_nh.param("shadow_gain", shadow_gain, std::vector<double>());
+    private_nh.param("shadow_max_acc_translation", shadow_max_acc, std::vector<double>());
+    size_t num_shadow = std::max(shadow_dist_wall.size(), std::max(shadow_gain.size(), shadow_max_acc.size()));
+    for (size_t i = 0; i < num_shadow; ++i) {
+        ShadowConfig config;
+        config.dist_vir_wall = (i < shadow_dist_wall.size()) ? shadow_dist_wall[i] : DISTANCE_VIRTUAL_WALL;
+        config.gain = (i < shadow_gain.size()) ? shadow_gain[i] : GAIN;
+        config.max_acc = (i < shadow_max_acc.size()) ? shadow_max_acc[i] : MAX_ACC;
+        shadow_configs_.push_back(config);
+        ROS_INFO("Shadow configuration %d: dist_vir_wall = %f, gain = %f, max_acc = %f", (int)i, config.dist_vir_wall, config.gain, config.max_acc);
+    }
+    if (!shadow_configs_.empty()) shadow_thread_ = new boost::thread(boost::bind(&CarrotPlanner::shadowWorker, this));
+
+    //! In simulation, scans only come in through setLaserScan and commands stay within this planner's namespace
+    bool simulation;
+    private_nh.param("simulation", simulation, false);
+
+    //! Read laser data from a shared-memory ring if the driver writes one, else listen to the topic (no Nagle
+    //! buffering: every scan is needed as soon as it is sent)
+    private_nh.param("scan_ring", scan_ring_name_, std::string(""));
+    private_nh.param("scan_ring_poll_period", SCAN_RING_POLL_PERIOD, 0.001);
+    private_nh.param("scan_ring_timeout", SCAN_RING_TIMEOUT, 1.0);
+    if (scan_ring_name_.empty() && !simulation) {
+        laser_scan_sub_ = private_nh.subscribe("/amigo/base_laser/scan", 10, &CarrotPlanner::laserScanCallBack, this,
+                                               ros::TransportHints().tcpNoDelay());
+    }
 
-    //! Listen to laser data
-    laser_scan_sub_ = private_nh.subscribe("/amigo/base_laser/scan", 10, &CarrotPlanner::laserScanCallBack, this);
+    //! Optionally listen to footprint updates
+    private_nh.param("footprint_topic", footprint_topic_, std::string(""));
+    if (!footprint_topic_.empty()) {
+        footprint_sub_ = private_nh.subscribe(footprint_topic_, 1, &CarrotPlanner::footprintCallBack, this);
+    }
+
+    //! Optionally listen to odometry to adapt the acceleration limits
+    if (!odom_topic_.empty()) {
+        odom_sub_ = private_nh.subscribe(odom_topic_, 10, &CarrotPlanner::odomCallBack, this);
+    }
+
+    //! Optionally listen to speed zones
+    private_nh.param("speed_zone_topic", speed_zone_topic_, std::string(""));
+    private_nh.param("speed_zone_max_vel", SPEED_ZONE_MAX_VEL, MAX_VEL);
+    private_nh.param("speed_zone_default", SPEED_ZONE_DEFAULT, MAX_VEL);
+    private_nh.param("speed_zone_timeout", SPEED_ZONE_TIMEOUT, 0.0);
+    speed_zone_limit_ = MAX_VEL;
+    if (!speed_zone_topic_.empty()) {
+        //! Until the first raster arrives, the default applies
+        speed_zone_limit_ = SPEED_ZONE_DEFAULT;
+        speed_zone_sub_ = private_nh.subscribe(speed_zone_topic_, 1, &CarrotPlanner::speedZoneCallBack, this);
+    }
+
+    //! Optionally listen to a local costmap with obstacles from other sources
+    if (!costmap_topic_.empty()) {
+        costmap_sub_ = private_nh.subscribe(costmap_topic_, 1, &CarrotPlanner::costmapCallBack, this);
+    }
 
     //! Publishers
     if (visualization_) {
         virt_wall_pub_ = private_nh.advertise<sensor_msgs::LaserScan>("virtual_wall", 1);
         carrot_pub_ = private_nh.advertise<visualization_msgs::Marker>("carrot", 1);
+        obstacles_pub_ = private_nh.advertise<visualization_msgs::Marker>("obstacles", 1);
+    }
+    cmd_vel_pub_ = private_nh.advertise<geometry_msgs::Twist>(simulation ? "references" : "/amigo/base/references", 1);
+    limit_reasons_pub_ = private_nh.advertise<std_msgs::Float64MultiArray>("limit_reasons", 1);
+
+    //! Override inputs, in order of decreasing priority; the planner's own command has the lowest priority
+    private_nh.param("override_timeout", OVERRIDE_TIMEOUT, 0.5);
+    const char* override_names[] = {"safety", "teleop", "docking"};
+    for (int i = 0; i < 3; ++i) {
+        std::string topic;
+        private_nh.param(std::string(override_names[i]) + "_topic", topic, std::string(""));
+        if (topic.empty()) continue;
+
+        OverrideInput input;
+        input.name = override_names[i];
+        override_inputs_.push_back(input);
+        override_inputs_.back().sub = private_nh.subscribe<geometry_msgs::Twist>(topic, 1,
+            boost::bind(&CarrotPlanner::overrideCallBack, this, _1, override_inputs_.size() - 1));
+        ROS_INFO("Carrot planner arbitrates %s commands from %s", input.name.c_str(), topic.c_str());
     }
-    cmd_vel_pub_ = private_nh.advertise<geometry_msgs::Twist>("/amigo/base/references", 1);
 
     //! Tf
+    ROS_DEBUG("tue_carrot_planner: parameters and communication set up after %f [s]", (ros::WallTime::now() - t_construction_).toSec());
     tf_listener_ = new tf::TransformListener();
+    ROS_DEBUG("tue_carrot_planner: transform listener created after %f [s]", (ros::WallTime::now() - t_construction_).toSec());
+
+    //! Operational KPIs, published at a low rate and persisted across restarts
+    double kpi_period;
+    private_nh.param("kpi_period", kpi_period, 10.0);
+    private_nh.param("kpi_file", kpi_file_, std::string(""));
+    if (!kpi_file_.empty() && loadKpis(kpi_file_)) ROS_INFO("Loaded KPIs from %s", kpi_file_.c_str());
+    if (kpi_period > 0) {
+        kpi_pub_ = private_nh.advertise<diagnostic_msgs::DiagnosticStatus>("kpi", 1);
+        kpi_timer_ = private_nh.createTimer(ros::Duration(kpi_period), &CarrotPlanner::publishKpis, this);
+    }
 
-    //! Wait for laser data
+    //! Own control cycle for goals passed in through submitGoal
+    double control_rate;
+    private_nh.param("control_rate", control_rate, 0.0);
+    private_nh.param("goal_timeout", GOAL_TIMEOUT, 0.5);
+    if (control_rate > 0) {
+        //! On its own queue and thread, so a slow callback on the global queue cannot delay the cycle
+        ros::NodeHandle control_nh(private_nh);
+        control_nh.setCallbackQueue(&control_queue_);
+        control_timer_ = control_nh.createTimer(ros::Duration(1.0 / control_rate), &CarrotPlanner::controlCycle, this);
+        control_spinner_ = new ros::AsyncSpinner(1, &control_queue_);
+        control_spinner_->start();
+    }
+
+    //! Scans from the ring are handled as soon as everything they touch is set up
+    if (!scan_ring_name_.empty()) {
+        scan_ring_thread_ = new boost::thread(boost::bind(&CarrotPlanner::scanRingIngest, this));
+        ROS_INFO("Carrot planner reads scans from shared-memory ring %s", scan_ring_name_.c_str());
+    }
+
+    //! Wait for laser data, unless scans are fed in through setLaserScan
+    bool wait_for_laser;
+    private_nh.param("wait_for_laser", wait_for_laser, !simulation);
     double t = ros::Time::now().toSec();
-    ros::Rate r(20.0);
-    while (!laser_data_available_)
+    while (wait_for_laser && !laser_data_available_ && ros::ok())
     {
-        ros::spinOnce();
-        r.sleep();
+        // Returns as soon as a scan arrives instead of at the next tick of a fixed rate
+        ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.05));
     }
-    ROS_INFO("tue_carrot_planner waited %f [s] for laser data!", ros::Time::now().toSec()-t);
+    if (wait_for_laser) ROS_INFO("tue_carrot_planner waited %f [s] for laser data!", ros::Time::now().toSec()-t);
+    ROS_INFO("tue_carrot_planner constructed in %f [s]", (ros::WallTime::now() - t_construction_).toSec());
 
 }
 
 
 CarrotPlanner::~CarrotPlanner() {
 	
+	control_timer_.stop();
+	if (control_spinner_) control_spinner_->stop();
+	delete control_spinner_;
+	if (scan_ring_thread_) {
+		scan_ring_stop_ = true;
+		scan_ring_thread_->join();
+		delete scan_ring_thread_;
+	}
+	if (shadow_thread_) {
+		{
+			boost::mutex::scoped_lock lock(shadow_mutex_);
+			shadow_stop_ = true;
+		}
+		shadow_cond_.notify_one();
+		shadow_thread_->join();
+		delete shadow_thread_;
+	}
 	delete tf_listener_;
+	delete latest_goal_.exchange(0);
+}
+
+
+void CarrotPlanner::submitGoal(const geometry_msgs::PoseStamped& goal) {
+
+    //! Publish a private copy; whatever it replaces was never consumed and is dropped
+    geometry_msgs::PoseStamped* replaced = latest_goal_.exchange(new geometry_msgs::PoseStamped(goal));
+    delete replaced;
+}
+
+
+void CarrotPlanner::setRobotRadius(double radius) {
+
+    if (radius <= 0) {
+        ROS_ERROR("Invalid robot radius %f, keeping %f", radius, radius_robot_.load());
+        return;
+    }
+    if (radius != radius_robot_.load()) ROS_INFO("Carrot planner robot radius changed to %f [m]", radius);
+    radius_robot_.store(radius);
+}
+
+
+void CarrotPlanner::footprintCallBack(const geometry_msgs::PolygonStamped::ConstPtr& footprint) {
+
+    //! The circumscribed radius of the footprint, with the configured radius as lower bound
+    double radius = RADIUS_ROBOT;
+    for (size_t i = 0; i < footprint->polygon.points.size(); ++i) {
+        const geometry_msgs::Point32& p = footprint->polygon.points[i];
+        radius = std::max(radius, (double)sqrt(p.x * p.x + p.y * p.y));
+    }
+    setRobotRadius(radius);
+}
+
+
+void CarrotPlanner::controlCycle(const ros::TimerEvent& event) {
+
+    //! Take the latest submitted goal, if any
+    geometry_msgs::PoseStamped* goal = latest_goal_.exchange(0);
+    if (goal) {
+        submitted_goal_ = *goal;
+        t_submitted_goal_ = event.current_real;
+        has_submitted_goal_ = true;
+        delete goal;
+    }
+
+    if (!has_submitted_goal_) return;
+
+    //! Producers stopped sending: stop instead of chasing an old carrot
+    if ((event.current_real - t_submitted_goal_).toSec() > GOAL_TIMEOUT) {
+        ROS_WARN("No goal submitted for %f [s], stopping", GOAL_TIMEOUT);
+        has_submitted_goal_ = false;
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        stop(true, event.current_real);
+        return;
+    }
+
+    MoveToGoal(submitted_goal_, event.current_real);
 }
 
 
 void CarrotPlanner::freeze()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex_);
+
+	// An explicit stop is not replaced by override inputs
+	stop(false, clockNow());
+}
+
+
+void CarrotPlanner::stop(bool allow_override, const ros::Time& now)
 {
 	// Administration
+	if (robot_did_move_) {
+		++kpi_total_.freezes;
+		++kpi_window_.freezes;
+	}
 	robot_did_move_ = false;
 	
 	// Publish command
@@ -60,59 +308,200 @@ void CarrotPlanner::freeze()
     cmd_vel.linear.x = 0;
     cmd_vel.linear.y = 0;
     cmd_vel.angular.z = 0;
-    cmd_vel_pub_.publish(cmd_vel);
+    publishCmdVel(cmd_vel, cmd_vel_pub_, now, allow_override);
 }
 
 
 bool CarrotPlanner::MoveToGoal(geometry_msgs::PoseStamped &goal){
 
+    return MoveToGoal(goal, ros::Time::now());
+}
+
+
+bool CarrotPlanner::MoveToGoal(geometry_msgs::PoseStamped &goal, const ros::Time& now){
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    //! Inputs arriving between cycles are stamped on the clock of the cycle
+    clock_offset_ = now.toSec() - ros::Time::now().toSec();
+
 	// return false: zero velocity
 	// return true: non-zero velocity
 
     //! Velocity that will be published
     geometry_msgs::Twist cmd_vel;
 
+    //! Limiting reasons are collected during the cycle
+    limit_reasons_ = REASON_NONE;
+    blocking_beam_ = -1;
+    blocking_distance_ = 0;
+
     //! If the goal is valid
     if (setGoal(goal))
     {
 		
-		//! Compute velocity command
-        bool non_zero_vel = computeVelocityCommand(cmd_vel);
+		//! Speed limit of the zone the robot is in
+		if (!speed_zone_topic_.empty()) updateSpeedZoneLimit(now);
+
+		//! Compute velocity command (goal_ is reset if the path is blocked, keep the requested one for the shadow configurations)
+        tf::Vector3 goal_requested = goal_;
+        bool non_zero_vel = computeVelocityCommand(cmd_vel, now);
         
-        //! In case robot should not move: freeze
+        //! In case robot should not move: stop, override inputs may still drive
         if (!non_zero_vel || (goal_.getX() == 0 && goal_.getY() == 0 && goal_angle_ == 0) )
         {
-			freeze();
+			stop(true, now);
+			if (shadow_thread_) submitShadowJob(goal_requested);
+			updateKpis(geometry_msgs::Twist(), now);
+			publishLimitReasons();
 			return false;
 		}
 
 		//! Else: robot should move, publish command
         ROS_DEBUG("Publishing velocity command: (x,y,th) = (%f.%f,%f)", cmd_vel.linear.x, cmd_vel.linear.y, cmd_vel.angular.z);
-        cmd_vel_pub_.publish(cmd_vel);
+        publishCmdVel(cmd_vel, cmd_vel_pub_, now);
         robot_did_move_ = true;
+        if (time_to_first_command_ < 0) {
+            time_to_first_command_ = (ros::WallTime::now() - t_construction_).toSec();
+            ROS_INFO("tue_carrot_planner: first velocity command %f [s] after construction", time_to_first_command_);
+        }
+
+        //! Shadow configurations are evaluated on their own thread after the command is out, they never delay it
+        if (shadow_thread_) submitShadowJob(goal_requested);
+        updateKpis(cmd_vel, now);
+        publishLimitReasons();
 
         return true;
 
     }
 
     //! In case the goal is invalid: do not move
-    freeze();
+    stop(true, now);
+    updateKpis(geometry_msgs::Twist(), now);
+    publishLimitReasons();
     return false;
 }
 
+void CarrotPlanner::updateKpis(const geometry_msgs::Twist& cmd_vel, const ros::Time& now) {
+
+    //! Time since the previous cycle; gaps between goals are not counted
+    double dt = (t_last_kpi_.isZero()) ? 0 : (now - t_last_kpi_).toSec();
+    t_last_kpi_ = now;
+    if (dt <= 0 || dt > 1.0) return;
+
+    double speed = sqrt(cmd_vel.linear.x * cmd_vel.linear.x + cmd_vel.linear.y * cmd_vel.linear.y);
+    Kpi* kpis[] = {&kpi_total_, &kpi_window_};
+    for (int i = 0; i < 2; ++i) {
+        kpis[i]->time += dt;
+        if (!path_free_) kpis[i]->blocked_time += dt;
+        if (scaling_factor_safety_ < 1.0) kpis[i]->ramp_time += dt;
+        kpis[i]->distance += speed * dt;
+    }
+}
+
+void CarrotPlanner::publishKpis(const ros::TimerEvent& event) {
+
+    //! Copy the KPIs and start a new window under the lock, the control cycle must not wait for the disk
+    Kpi total, window;
+    {
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+        total = kpi_total_;
+        window = kpi_window_;
+        kpi_window_ = Kpi();
+    }
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "tue_carrot_planner";
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    addKpiValues(window, "window_", status);
+    addKpiValues(total, "total_", status);
+    kpi_pub_.publish(status);
+
+    //! Persist the totals
+    if (!kpi_file_.empty()) saveKpis(kpi_file_, total);
+}
+
+void CarrotPlanner::addKpiValues(const Kpi& kpi, const std::string& prefix, diagnostic_msgs::DiagnosticStatus& status) {
+
+    std::vector<std::pair<std::string, double> > values;
+    values.push_back(std::make_pair("time", kpi.time));
+    values.push_back(std::make_pair("blocked_time", kpi.blocked_time));
+    values.push_back(std::make_pair("ramp_time", kpi.ramp_time));
+    values.push_back(std::make_pair("distance", kpi.distance));
+    values.push_back(std::make_pair("freezes", (double)kpi.freezes));
+    values.push_back(std::make_pair("average_speed", (kpi.time > 0) ? kpi.distance / kpi.time : 0));
+    values.push_back(std::make_pair("freezes_per_meter", (kpi.distance > 0) ? kpi.freezes / kpi.distance : 0));
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        diagnostic_msgs::KeyValue key_value;
+        key_value.key = prefix + values[i].first;
+        std::ostringstream value;
+        value << values[i].second;
+        key_value.value = value.str();
+        status.values.push_back(key_value);
+    }
+}
+
+bool CarrotPlanner::loadKpis(const std::string& filename) {
+
+    std::ifstream file(filename.c_str());
+    if (!file.is_open()) return false;
+
+    std::string key;
+    double value;
+    while (file >> key >> value) {
+        if (key == "time") kpi_total_.time = value;
+        else if (key == "blocked_time") kpi_total_.blocked_time = value;
+        else if (key == "ramp_time") kpi_total_.ramp_time = value;
+        else if (key == "distance") kpi_total_.distance = value;
+        else if (key == "freezes") kpi_total_.freezes = value;
+    }
+    return true;
+}
+
+bool CarrotPlanner::saveKpis(const std::string& filename, const Kpi& kpi) {
+
+    //! Write a temporary file and rename it, so a crash while writing never loses the previous totals
+    std::string tmp_filename = filename + ".tmp";
+    std::ofstream file(tmp_filename.c_str());
+    if (!file.is_open()) {
+        ROS_WARN_THROTTLE(60.0, "Cannot write KPIs to %s", tmp_filename.c_str());
+        return false;
+    }
+
+    //! Full precision, the totals are reloaded and accumulated further
+    file << std::setprecision(17);
+    file << "time " << kpi.time << std::endl;
+    file << "blocked_time " << kpi.blocked_time << std::endl;
+    file << "ramp_time " << kpi.ramp_time << std::endl;
+    file << "distance " << kpi.distance << std::endl;
+    file << "freezes " << kpi.freezes << std::endl;
+    file.close();
+    if (file.fail() || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        ROS_WARN_THROTTLE(60.0, "Cannot write KPIs to %s", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
 bool CarrotPlanner::setGoal(geometry_msgs::PoseStamped &goal){
 
     //! Check frame of the goal
     if (goal.header.frame_id != tracking_frame_){
         ROS_ERROR("Expecting goal in frame %s, no planning possible", tracking_frame_.c_str());
+        limit_reasons_ |= REASON_INVALID_FRAME;
         return false;
     }
 
+    //! Goals stamped in the past are relative to where the robot was at that time
+    geometry_msgs::PoseStamped goal_now = goal;
+    if (propagate_goal_stamp_ && !goal.header.stamp.isZero()) propagateGoal(goal, goal_now);
+
     //! Determine pose of the goal
-    goal_angle_ = tf::getYaw(goal.pose.orientation);
-    goal_.setX(goal.pose.position.x);
-    goal_.setY(goal.pose.position.y);
-    goal_.setZ(goal.pose.position.z);
+    goal_angle_ = tf::getYaw(goal_now.pose.orientation);
+    goal_.setX(goal_now.pose.position.x);
+    goal_.setY(goal_now.pose.position.y);
+    goal_.setZ(goal_now.pose.position.z);
 
     // TODO: Check if this makes sense
     //! Check for maximum angle, if needed move y-position goal such that truncated angle matches desired (x,y)-position
@@ -131,12 +520,22 @@ bool CarrotPlanner::setGoal(geometry_msgs::PoseStamped &goal){
     ROS_DEBUG("CarrotPlanner::setGoal: (x,y,th) = (%f,%f,%f)", goal_.getX(), goal_.getY(), goal_angle_);
 
     //! Avoid nervous rotations
-    //if (goal_.getX() == 0 && goal_.getY() == 0 && goal_angle_ < MIN_ANGLE_ZERO_TRANS && goal_angle_ > -MIN_ANGLE_ZERO_TRANS)
-    //{
-    //    ROS_INFO("Carrotplanner will ignore small angle %f", goal_angle_);
-    //    goal_angle_ = 0;
-    //}
-    
+    filterGoal();
+
+    //! When docking, the final pose is taken relative to the dock face in the scan
+    if (docking_) {
+        dock_line_valid_ = refineDockingGoal();
+
+        //! Docked: hold still instead of chasing noise of the line fit (leaving takes twice the tolerances)
+        double scale = dock_reached_ ? 2.0 : 1.0;
+        dock_reached_ = goal_.length() < scale * DOCKING_TOLERANCE && fabs(goal_angle_) < scale * DOCKING_ANGLE_TOLERANCE;
+        if (dock_reached_) {
+            ROS_DEBUG("Docking: within tolerance of the dock");
+            goal_.setValue(0, 0, 0);
+            goal_angle_ = 0;
+        }
+    }
+
     //ROS_INFO("tue_carrot_planner: request to move towards (x,y,theta) = (%f,%f,%f)", goal.pose.position.x, goal.pose.position.y, goal_angle_);
 
     //! Publish marker
@@ -146,10 +545,213 @@ bool CarrotPlanner::setGoal(geometry_msgs::PoseStamped &goal){
 
 }
 
-bool CarrotPlanner::computeVelocityCommand(geometry_msgs::Twist &cmd_vel){
+void CarrotPlanner::filterGoal() {
+
+    if (GOAL_FILTER_GAIN < 1.0) {
+
+        //! Filter in the odometry frame, otherwise the motion of the robot makes the filtered goal lag behind
+        tf::StampedTransform base_to_odom;
+        try {
+            tf_listener_->lookupTransform(odom_frame_, tracking_frame_, ros::Time(0), base_to_odom);
+        } catch (tf::TransformException& ex) {
+            ROS_WARN_THROTTLE(1.0, "No transform to %s, goal not filtered: %s", odom_frame_.c_str(), ex.what());
+            base_to_odom.setIdentity();
+            goal_filter_initialized_ = false;
+        }
+        double yaw = tf::getYaw(base_to_odom.getRotation());
+        tf::Vector3 goal_odom = base_to_odom * goal_;
+        double goal_angle_odom = goal_angle_ + yaw;
+
+        //! Large jumps are a new goal rather than noise: restart the filter there
+        double angle_diff = atan2(sin(goal_angle_odom - filtered_goal_angle_), cos(goal_angle_odom - filtered_goal_angle_));
+        if (!goal_filter_initialized_ || (goal_odom - filtered_goal_).length() > GOAL_FILTER_JUMP || fabs(angle_diff) > GOAL_FILTER_JUMP_ANGLE) {
+            if (goal_filter_initialized_) ROS_DEBUG("Goal jumped, filter bypassed");
+            filtered_goal_ = goal_odom;
+            filtered_goal_angle_ = goal_angle_odom;
+            goal_filter_initialized_ = true;
+        } else {
+            //! First order low-pass
+            filtered_goal_ = filtered_goal_ + (goal_odom - filtered_goal_) * GOAL_FILTER_GAIN;
+            filtered_goal_angle_ = filtered_goal_angle_ + angle_diff * GOAL_FILTER_GAIN;
+            filtered_goal_angle_ = atan2(sin(filtered_goal_angle_), cos(filtered_goal_angle_));
+        }
+
+        //! Back to the tracking frame
+        goal_ = base_to_odom.inverse() * filtered_goal_;
+        goal_angle_ = atan2(sin(filtered_goal_angle_ - yaw), cos(filtered_goal_angle_ - yaw));
+    }
+
+    //! Avoid nervous rotations: small angles without translation are ignored (the filter may leave rounding errors)
+    if (goal_.length() < 1e-6 && goal_angle_ < MIN_ANGLE_ZERO_TRANS && goal_angle_ > -MIN_ANGLE_ZERO_TRANS)
+    {
+        ROS_DEBUG("Carrotplanner will ignore small angle %f", goal_angle_);
+        goal_.setValue(0, 0, 0);
+        goal_angle_ = 0;
+    }
+}
+
+bool CarrotPlanner::refineDockingGoal() {
+
+    //! The dock face is expected at the standoff distance in front of the goal
+    tf::Vector3 face(goal_.getX() + DOCKING_STANDOFF * cos(goal_angle_), goal_.getY() + DOCKING_STANDOFF * sin(goal_angle_), 0);
+
+    double nx, ny, d;
+    if (!fitDockLine(face, nx, ny, d)) {
+        ROS_WARN_THROTTLE(1.0, "Docking: no dock face found near (%f,%f), using goal as is", face.getX(), face.getY());
+        return false;
+    }
+
+    //! Let the normal point away from the robot, the robot is at the origin
+    if (d < 0) {
+        nx = -nx;
+        ny = -ny;
+        d = -d;
+    }
+
+    //! Project the expected face point on the line and step back along the normal
+    double dist_face = nx * face.getX() + ny * face.getY() - d;
+    double px = face.getX() - dist_face * nx;
+    double py = face.getY() - dist_face * ny;
+    goal_.setX(px - DOCKING_STANDOFF * nx);
+    goal_.setY(py - DOCKING_STANDOFF * ny);
+    goal_.setZ(0);
+    goal_angle_ = atan2(ny, nx);
+    ROS_DEBUG("Docking: goal refined to (%f,%f,%f)", goal_.getX(), goal_.getY(), goal_angle_);
+
+    //! Keep the face, to exempt it from the obstacle checks
+    dock_nx_ = nx;
+    dock_ny_ = ny;
+    dock_d_ = d;
+    dock_face_x_ = px;
+    dock_face_y_ = py;
+
+    return true;
+}
+
+bool CarrotPlanner::fitDockLine(const tf::Vector3& center, double& nx, double& ny, double& d) {
+
+    if (!laser_data_available_ || beam_cos_.size() != laser_scan_->ranges.size()) return false;
+
+    //! Scan points near the expected dock face
+    dock_x_.clear();
+    dock_y_.clear();
+    double radius2 = DOCKING_SEARCH_RADIUS * DOCKING_SEARCH_RADIUS;
+    for (size_t j = 0; j < laser_scan_->ranges.size(); ++j) {
+        float r = laser_scan_->ranges[j];
+        if (r <= 0.001f) continue;
+        float x = r * beam_cos_[j];
+        float y = r * beam_sin_[j];
+        double dx = x - center.getX(), dy = y - center.getY();
+        if (dx * dx + dy * dy < radius2) {
+            dock_x_.push_back(x);
+            dock_y_.push_back(y);
+        }
+    }
+    int n = dock_x_.size();
+    if (n < DOCKING_MIN_INLIERS) return false;
+
+    //! RANSAC with a fixed seed, so the same scan always gives the same line
+    const float* xs = &dock_x_[0];
+    const float* ys = &dock_y_[0];
+    float threshold = DOCKING_INLIER_DISTANCE;
+    unsigned int seed = 12345;
+    int best_inliers = 0;
+    float best_nx = 0, best_ny = 0, best_d = 0;
+    for (int it = 0; it < DOCKING_RANSAC_ITERATIONS; ++it) {
+        seed = seed * 1103515245 + 12345;
+        int i1 = (seed >> 16) % n;
+        seed = seed * 1103515245 + 12345;
+        int i2 = (seed >> 16) % n;
+        float lx = xs[i2] - xs[i1], ly = ys[i2] - ys[i1];
+        float length = sqrt(lx * lx + ly * ly);
+        if (length < 2 * threshold) continue;
+
+        float cnx = -ly / length, cny = lx / length;
+        float cd = cnx * xs[i1] + cny * ys[i1];
+
+        //! Branch-free inlier count
+        int inliers = 0;
+        for (int k = 0; k < n; ++k) {
+            inliers += fabsf(cnx * xs[k] + cny * ys[k] - cd) < threshold;
+        }
+        if (inliers > best_inliers) {
+            best_inliers = inliers;
+            best_nx = cnx;
+            best_ny = cny;
+            best_d = cd;
+        }
+    }
+    if (best_inliers < DOCKING_MIN_INLIERS) return false;
+
+    //! Least squares refit on the inliers: the normal is the direction of least variance
+    double mx = 0, my = 0;
+    int count = 0;
+    for (int k = 0; k < n; ++k) {
+        if (fabs(best_nx * xs[k] + best_ny * ys[k] - best_d) < threshold) {
+            mx += xs[k];
+            my += ys[k];
+            ++count;
+        }
+    }
+    mx /= count;
+    my /= count;
+    double sxx = 0, sxy = 0, syy = 0;
+    for (int k = 0; k < n; ++k) {
+        if (fabs(best_nx * xs[k] + best_ny * ys[k] - best_d) < threshold) {
+            double dx = xs[k] - mx, dy = ys[k] - my;
+            sxx += dx * dx;
+            sxy += dx * dy;
+            syy += dy * dy;
+        }
+    }
+    double theta = 0.5 * atan2(2 * sxy, sxx - syy); // direction of the line
+    nx = -sin(theta);
+    ny = cos(theta);
+    d = nx * mx + ny * my;
+    ROS_DEBUG("Docking: line fitted with %d of %d points", count, n);
+
+    return true;
+}
+
+const sensor_msgs::LaserScan& CarrotPlanner::scanWithoutDockFace(const sensor_msgs::LaserScan& scan) {
+
+    if (!docking_ || !dock_line_valid_ || beam_cos_.size() != scan.ranges.size()) return scan;
+
+    //! Points on the fitted dock face only count as obstacles closer than the standoff, where the approach ends
+    masked_scan_ = scan;
+    float band = 3 * DOCKING_INLIER_DISTANCE;
+    double radius2 = DOCKING_SEARCH_RADIUS * DOCKING_SEARCH_RADIUS;
+    for (size_t j = 0; j < scan.ranges.size(); ++j) {
+        float r = scan.ranges[j];
+        if (r < DOCKING_STANDOFF) continue;
+        double x = r * beam_cos_[j], y = r * beam_sin_[j];
+        double dx = x - dock_face_x_, dy = y - dock_face_y_;
+        if (fabs(dock_nx_ * x + dock_ny_ * y - dock_d_) < band && dx * dx + dy * dy < radius2) masked_scan_.ranges[j] = 0;
+    }
+
+    return masked_scan_;
+}
+
+bool CarrotPlanner::propagateGoal(const geometry_msgs::PoseStamped& goal, geometry_msgs::PoseStamped& goal_now) {
+
+    //! Express the goal in the odometry frame at its stamp and back in the tracking frame at the latest time
+    try {
+        tf_listener_->transformPose(tracking_frame_, ros::Time(0), goal, odom_frame_, goal_now);
+    } catch (tf::TransformException& ex) {
+        ROS_WARN_THROTTLE(1.0, "Cannot propagate goal from its stamp using %s, using it as is: %s", odom_frame_.c_str(), ex.what());
+        goal_now = goal;
+        return false;
+    }
+
+    ROS_DEBUG("Propagated goal over %f [s] from (%f,%f) to (%f,%f)", (ros::Time::now() - goal.header.stamp).toSec(),
+              goal.pose.position.x, goal.pose.position.y, goal_now.pose.position.x, goal_now.pose.position.y);
+    return true;
+}
+
+bool CarrotPlanner::computeVelocityCommand(geometry_msgs::Twist &cmd_vel, const ros::Time& now){
 
     //! Determine dt since last callback
-    double time = ros::Time::now().toSec() + ros::Time::now().toNSec() / 1e9;
+    double time = now.toSec();
     double dt = 0;
     if (t_last_cmd_vel_ > 0) {
         dt = time - t_last_cmd_vel_;
@@ -157,21 +759,29 @@ bool CarrotPlanner::computeVelocityCommand(geometry_msgs::Twist &cmd_vel){
     t_last_cmd_vel_ = time;
     ROS_DEBUG("Goal before isClearLine() is (x,y,theta): (%f,%f,%f)", goal_.getX(), goal_.getY(), goal_angle_);
 
+    //! In a narrow passage, steer the carrot towards its centre line
+    if (doorway_centering_) centerInPassage();
+
     //! Check if the path is free
-    if (!isClearLine()) {
+    bool path_free = isClearLine();
+    path_free_ = path_free;
+    if (!path_free) {
         ROS_DEBUG("Path is not free: only consider rotation");
 
         // If only rotating in case of a blocked path is not allowed: no movements
         if (!allow_rotate_only_)
         {
             ROS_DEBUG("Not allowed to rotate when path is blocked");
+            limit_reasons_ |= REASON_BLOCKED_NO_ROTATE;
             cmd_vel.angular.x = 0;
             cmd_vel.angular.y = 0;
             cmd_vel.angular.z = 0;
+            monitorBehaviour(cmd_vel, path_free, now.toSec());
             return false;
         }
 
         // Else, only consider rotation in case of a blocked path
+        limit_reasons_ |= REASON_ROTATE_ONLY;
         setZeroVelocity(cmd_vel);
         goal_.setX(0);
         goal_.setY(0);
@@ -197,7 +807,199 @@ bool CarrotPlanner::computeVelocityCommand(geometry_msgs::Twist &cmd_vel){
 
     //! Determine velocity
     determineDesiredVelocity(dt, cmd_vel);
+    if (velocity_obstacle_avoidance_ && path_free) avoidObstacles(dt, cmd_vel);
+    limitLateralAcceleration(dt, cmd_vel);
+
+    //! A protective stop holds until a newer scan shows the field clear for this command
+    if (checkProtectiveStop(cmd_vel)) {
+        ROS_DEBUG("Protective stop latched: no motion");
+        limit_reasons_ |= REASON_PROTECTIVE_STOP;
+        setZeroVelocity(cmd_vel);
+        cmd_vel.angular.z = 0;
+        last_cmd_vel_ = cmd_vel;
+        monitorBehaviour(cmd_vel, path_free, now.toSec());
+        return false;
+    }
+
+    //! Compare the response of the base with the previous command before storing this one
+    if (!odom_topic_.empty()) adaptAccelerationLimits(cmd_vel, now.toSec());
     last_cmd_vel_ = cmd_vel;
+    monitorBehaviour(cmd_vel, path_free, now.toSec());
+
+    return true;
+}
+
+void CarrotPlanner::monitorBehaviour(const geometry_msgs::Twist& cmd_vel, bool path_free, double time) {
+
+    //! Oscillation: count sign flips of the rotational command within the window
+    if (cmd_vel.angular.z != 0) {
+        double angular_sign = sign(cmd_vel.angular.z);
+        if (last_angular_sign_ != 0 && angular_sign != last_angular_sign_) flip_times_.push_back(time);
+        last_angular_sign_ = angular_sign;
+    }
+    while (!flip_times_.empty() && time - flip_times_.front() > OSCILLATION_WINDOW) flip_times_.pop_front();
+    if (isOscillating()) {
+        ROS_WARN_THROTTLE(1.0, "Carrot planner oscillates: %d sign flips of the rotation in %f [s]", (int)flip_times_.size(), OSCILLATION_WINDOW);
+    }
+
+    //! Deadlock: path blocked for too long
+    if (path_free) {
+        t_blocked_since_ = -1;
+    } else if (t_blocked_since_ < 0) {
+        t_blocked_since_ = time;
+    }
+    deadlocked_ = t_blocked_since_ >= 0 && time - t_blocked_since_ > DEADLOCK_TIMEOUT;
+    if (deadlocked_) {
+        ROS_WARN_THROTTLE(1.0, "Carrot planner is blocked for %f [s]", time - t_blocked_since_);
+    }
+}
+
+double CarrotPlanner::desiredSpeed(double distance, double gain, double acc, double speed_limit, bool docking) const {
+
+    //! Same speed profile as determineDesiredVelocity, before acceleration limits and startup scaling
+    if (distance <= 0) return 0;
+    double v = std::min(std::min(MAX_VEL, gain * sqrt(2 * distance * acc)), speed_limit);
+    if (docking) return (distance < DOCKING_TOLERANCE) ? 0 : std::min(v, std::max(DOCKING_GAIN * distance, DOCKING_MIN_VEL));
+    return v * std::min(distance * 2.0/3.0, 1.0);
+}
+
+void CarrotPlanner::submitShadowJob(const tf::Vector3& goal) {
+
+    if (!laser_data_available_) return;
+
+    //! Exactly what production checked: the scan without the dock face and the costmap, unless production skipped it
+    ShadowJob job;
+    const sensor_msgs::LaserScan& scan = scanWithoutDockFace(*laser_scan_);
+    job.scan = (&scan == laser_scan_.get()) ? laser_scan_ : sensor_msgs::LaserScan::ConstPtr(new sensor_msgs::LaserScan(scan));
+    job.goal = goal;
+    job.carrot = carrot_checked_;
+    job.goal_angle = goal_angle_;
+    job.radius_robot = radius_robot_.load();
+    job.speed_limit = speed_zone_limit_;
+    job.docking = docking_;
+    job.path_free = path_free_;
+    job.v_production = path_free_ ? desiredSpeed(goal.length(), GAIN, acc_lin_, speed_zone_limit_, docking_) : 0;
+    if (costmap_available_ && !(docking_ && dock_line_valid_)) {
+        job.costmap_dt = costmap_dt_;
+        job.costmap_info = costmap_info_;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(shadow_mutex_);
+        if (shadow_job_pending_) ++shadow_skipped_;
+        shadow_job_ = job;
+        shadow_job_pending_ = true;
+    }
+    shadow_cond_.notify_one();
+}
+
+void CarrotPlanner::shadowWorker() {
+
+    while (true) {
+        ShadowJob job;
+        {
+            boost::mutex::scoped_lock lock(shadow_mutex_);
+            while (!shadow_job_pending_ && !shadow_stop_) shadow_cond_.wait(lock);
+            if (shadow_stop_) return;
+            job = shadow_job_;
+            shadow_job_ = ShadowJob();
+            shadow_job_pending_ = false;
+        }
+
+        evaluateShadowConfigs(job);
+
+        //! The summary is only built when the message is actually logged
+        ROS_INFO_THROTTLE(10.0, "Shadow configurations:%s", shadowSummary().c_str());
+    }
+}
+
+void CarrotPlanner::evaluateShadowConfigs(const ShadowJob& job) {
+
+    //! Same checks as isClearLine, with the wall of the candidate
+    double distance = job.goal.length();
+    for (std::vector<ShadowConfig>::iterator it = shadow_configs_.begin(); it != shadow_configs_.end(); ++it) {
+
+        ros::WallTime t_start = ros::WallTime::now();
+
+        bool path_free = isClearLine(*job.scan, job.goal_angle, it->dist_vir_wall, job.radius_robot);
+        if (path_free && job.costmap_dt) path_free = isClearCostmap(*job.costmap_dt, job.costmap_info, job.carrot, it->dist_vir_wall);
+        double v_shadow = path_free ? desiredSpeed(distance, it->gain, it->max_acc, job.speed_limit, job.docking) : 0;
+
+        ++it->cycles;
+        if (!path_free) ++it->blocked;
+        if (path_free != job.path_free) ++it->blocked_diff;
+        it->speed_diff_sum += v_shadow - job.v_production;
+        it->compute_time += (ros::WallTime::now() - t_start).toSec();
+    }
+}
+
+std::string CarrotPlanner::shadowSummary() const {
+
+    //! Relative to the production configuration, one message for all configurations
+    std::ostringstream summary;
+    for (size_t i = 0; i < shadow_configs_.size(); ++i) {
+        const ShadowConfig& config = shadow_configs_[i];
+        summary << "\n  configuration " << i << ": " << config.cycles << " cycles, " << config.blocked << " blocked, "
+                << config.blocked_diff << " blocked decisions differ, mean speed difference " << config.speed_diff_sum / config.cycles
+                << " [m/s], mean compute time " << config.compute_time / config.cycles * 1000.0 << " [ms]";
+    }
+    summary << "\n  " << shadow_skipped_ << " cycles skipped";
+    return summary.str();
+}
+
+bool CarrotPlanner::centerInPassage() {
+
+    //! Only if driving forward towards the goal
+    if (!laser_data_available_ || goal_.getX() <= 0 || beam_cos_.size() != laser_scan_->ranges.size()) return false;
+
+    //! Walls are the segmented obstacles that lie on one side of the robot within the lookahead and reach beyond the
+    //! width of the robot, like the wall next to a door frame. Obstacles ahead, compact or on both sides, are left to
+    //! the clear-line check. The nearest point of a wall may be closer than the robot radius: that is the frame the
+    //! robot is about to graze.
+    const float* ranges = &laser_scan_->ranges[0];
+    const float* c = &beam_cos_[0];
+    const float* s = &beam_sin_[0];
+    float band = DOORWAY_MAX_WIDTH;
+    float lookahead = DISTANCE_VIRTUAL_WALL;
+    float radius_robot = radius_robot_.load();
+    float left = band, right = -band;
+    for (size_t i = 0; i < obstacles_.size(); ++i) {
+        float nearest_left = band, nearest_right = -band, reach_left = 0, reach_right = 0;
+        for (int j = obstacles_[i].first_beam; j <= obstacles_[i].last_beam; ++j) {
+            float x = ranges[j] * c[j];
+            float y = ranges[j] * s[j];
+            bool in_band = (ranges[j] > 0.001f) & (x > 0) & (x < lookahead);
+            nearest_left = std::min(nearest_left, (in_band & (y > 0)) ? y : band);
+            nearest_right = std::max(nearest_right, (in_band & (y <= 0)) ? y : -band);
+            reach_left = std::max(reach_left, y);
+            reach_right = std::min(reach_right, y);
+        }
+        bool on_left = nearest_left < band, on_right = nearest_right > -band;
+        if (on_left && !on_right && reach_left >= radius_robot) left = std::min(left, nearest_left);
+        if (on_right && !on_left && reach_right <= -radius_robot) right = std::max(right, nearest_right);
+    }
+
+    //! Walls on both sides, close enough together to be a passage
+    if (left >= band || right <= -band || left - right > DOORWAY_MAX_WIDTH) return false;
+
+    //! Too narrow for the robot: do not steer into it
+    if (left - right < 2 * radius_robot) {
+        ROS_DEBUG("Passage of %f [m] is too narrow for the robot", left - right);
+        return false;
+    }
+
+    //! Only if the path to the goal goes through the passage, e.g. not to a side door in a corridor
+    double x_passage = std::min(goal_.getX(), (double)lookahead);
+    double y_path = goal_.getY() * x_passage / goal_.getX();
+    if (y_path <= right || y_path >= left) return false;
+
+    //! Shift the point where the path crosses the passage sideways by the offset of its centre, and aim the carrot at
+    //! it, keeping the distance to the goal
+    double offset = (left + right) / 2.0;
+    tf::Vector3 carrot(x_passage, y_path + offset, 0);
+    double distance = goal_.length();
+    goal_ = carrot.normalized() * distance;
+    ROS_DEBUG("Passage of %f [m] wide, %f [m] off centre: carrot moved to (%f,%f)", left - right, offset, goal_.getX(), goal_.getY());
 
     return true;
 }
@@ -207,74 +1009,645 @@ bool CarrotPlanner::isClearLine(){
     //! Check if laser data is avaibale
     if (!laser_data_available_) {
         ROS_INFO("No laser data available: path considered blocked");
+        limit_reasons_ |= REASON_NO_LASER;
         return false;
     }
-    
-    double angle_goal = goal_angle_;
-    
-    //! Get number of beams
-    int num_readings = laser_scan_.ranges.size();
+
+    if (visualization_) publishVirtualWall(goal_angle_, virt_wall_pub_);
+
+    carrot_checked_ = goal_;
+    bool path_free = isClearLine(scanWithoutDockFace(*laser_scan_), goal_angle_, DISTANCE_VIRTUAL_WALL, radius_robot_.load(),
+                                 &blocking_beam_, &blocking_distance_);
+    if (!path_free) limit_reasons_ |= REASON_VIRTUAL_WALL;
+
+    //! Obstacles in the costmap only count if the laser did not block already; while docking the dock itself is in it
+    if (path_free && costmap_available_ && !(docking_ && dock_line_valid_)) {
+        path_free = isClearCostmap(*costmap_dt_, costmap_info_, goal_, DISTANCE_VIRTUAL_WALL);
+        if (!path_free) limit_reasons_ |= REASON_COSTMAP;
+    }
+
+    return path_free;
+}
+
+bool CarrotPlanner::isClearCostmap(const DistanceTransform& dt, const nav_msgs::OccupancyGrid& info, const tf::Vector3& goal,
+                                   double dist_wall) const {
+
+    //! Without translation there is no corridor to check
+    double length = std::min(goal.length(), dist_wall);
+    if (length < 1e-6) return true;
+
+    //! Transform from the tracking frame to the grid
+    tf::StampedTransform transform;
+    try {
+        tf_listener_->lookupTransform(info.header.frame_id, tracking_frame_, ros::Time(0), transform);
+    } catch (tf::TransformException& ex) {
+        ROS_WARN_THROTTLE(1.0, "No transform from %s to costmap frame: %s", tracking_frame_.c_str(), ex.what());
+        return true;
+    }
+    tf::Pose origin;
+    tf::poseMsgToTF(info.info.origin, origin);
+    tf::Transform base_to_grid = origin.inverse() * transform;
+
+    //! Sample the corridor every cell, each sample is a single lookup in the distance transform
+    double radius_robot = radius_robot_.load();
+    double resolution = info.info.resolution;
+    tf::Vector3 direction = goal.normalized();
+    int num_samples = length / resolution + 1;
+    for (int i = 0; i <= num_samples; ++i) {
+        tf::Vector3 p = base_to_grid * (direction * std::min(i * resolution, length));
+        int x = floor(p.getX() / resolution);
+        int y = floor(p.getY() / resolution);
+        if (x < 0 || y < 0 || x >= dt.width() || y >= dt.height()) continue;
+
+        double clearance = dt.distance(x, y) * resolution;
+        if (clearance < radius_robot) {
+            ROS_DEBUG("Costmap obstacle within %f [m] of the corridor at %f [m]", clearance, std::min(i * resolution, length));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CarrotPlanner::updateSpeedZoneLimit(const ros::Time& now) {
+
+    //! Without a (recent) raster the default applies. The raster is stamped on the clock of the cycle; a raster from the
+    //! future (the clock jumped back) is not recent either.
+    double age = (now - t_speed_zones_).toSec();
+    if (!speed_zone_available_ || (SPEED_ZONE_TIMEOUT > 0 && (age > SPEED_ZONE_TIMEOUT || age < 0))) {
+        ROS_WARN_THROTTLE(5.0, "No recent speed zones: limiting to %f [m/s]", SPEED_ZONE_DEFAULT);
+        speed_zone_limit_ = SPEED_ZONE_DEFAULT;
+        return;
+    }
+
+    //! Robot position in the grid
+    tf::StampedTransform transform;
+    try {
+        tf_listener_->lookupTransform(speed_zone_frame_, tracking_frame_, ros::Time(0), transform);
+    } catch (tf::TransformException& ex) {
+        ROS_WARN_THROTTLE(1.0, "No transform from %s to speed zone frame: %s", tracking_frame_.c_str(), ex.what());
+        speed_zone_limit_ = SPEED_ZONE_DEFAULT;
+        return;
+    }
+    tf::Vector3 p = speed_zone_origin_inv_ * transform.getOrigin();
+
+    //! Single lookup in the precomputed table
+    int x = floor(p.getX() / speed_zone_resolution_);
+    int y = floor(p.getY() / speed_zone_resolution_);
+    if (x < 0 || y < 0 || x >= speed_zone_width_ || y >= (int)speed_zones_.size() / speed_zone_width_) {
+        speed_zone_limit_ = SPEED_ZONE_DEFAULT;
+    } else {
+        speed_zone_limit_ = speed_zones_[y * speed_zone_width_ + x];
+    }
+    ROS_DEBUG("Speed zone limit is %f [m/s]", speed_zone_limit_);
+}
+
+void CarrotPlanner::speedZoneCallBack(const nav_msgs::OccupancyGrid::ConstPtr& zones) {
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    //! Cell values are a percentage of speed_zone_max_vel, unknown cells get speed_zone_default
+    speed_zones_.resize(zones->data.size());
+    for (size_t i = 0; i < zones->data.size(); ++i) {
+        speed_zones_[i] = (zones->data[i] < 0) ? SPEED_ZONE_DEFAULT : zones->data[i] / 100.0 * SPEED_ZONE_MAX_VEL;
+    }
+    speed_zone_frame_ = zones->header.frame_id;
+    speed_zone_resolution_ = zones->info.resolution;
+    speed_zone_width_ = std::max(1u, zones->info.width);
+    tf::Pose origin;
+    tf::poseMsgToTF(zones->info.origin, origin);
+    speed_zone_origin_inv_ = origin.inverse();
+    speed_zone_available_ = true;
+    t_speed_zones_ = clockNow();
+    ROS_INFO("Received speed zones of %dx%d cells in %s", zones->info.width, zones->info.height, speed_zone_frame_.c_str());
+}
+
+void CarrotPlanner::costmapCallBack(const nav_msgs::OccupancyGrid::ConstPtr& costmap) {
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    //! Only the geometry is kept, the cells go into the distance transform
+    costmap_info_.header = costmap->header;
+    costmap_info_.info = costmap->info;
+
+    std::vector<bool> occupied(costmap->data.size());
+    for (size_t i = 0; i < costmap->data.size(); ++i) {
+        occupied[i] = (costmap->data[i] >= COSTMAP_LETHAL_THRESHOLD);
+    }
+    //! Copy on write: a pending shadow job may still read the previous transform
+    if (!costmap_dt_.unique()) costmap_dt_.reset(new DistanceTransform(*costmap_dt_));
+    costmap_dt_->update(occupied, costmap->info.width, costmap->info.height);
+    costmap_available_ = true;
+}
+
+bool CarrotPlanner::isClearLine(const sensor_msgs::LaserScan& scan, double angle_goal, double dist_wall, double radius_robot,
+                                int* blocking_beam, double* blocking_distance) {
+
+    if (scan.ranges.empty()) return true;
+
+    return isClearLine(&scan.ranges[0], scan.ranges.size(), scan.angle_min, scan.angle_increment, angle_goal, dist_wall,
+                       radius_robot, blocking_beam, blocking_distance);
+}
+
+bool CarrotPlanner::isClearLine(const float* ranges, int num_readings, double angle_min, double angle_increment,
+                                double angle_goal, double dist_wall, double radius_robot,
+                                int* blocking_beam, double* blocking_distance) {
 
     //! Calculate the index corresponding to the beam that intersects with the target position
-    int num_incr = angle_goal/laser_scan_.angle_increment; // Both in rad
+    int num_incr = angle_goal/angle_increment; // Both in rad
     ROS_DEBUG("wall: angle %f corresponds to %d increments", angle_goal, num_incr);
     int index_beam_target_pos = std::max(0, num_readings/2 + num_incr);
 
     //! Check for collisions with virtual wall in front of the robot
-    double dth = atan2(RADIUS_ROBOT, DISTANCE_VIRTUAL_WALL);
-    int d_step = dth/laser_scan_.angle_increment;
+    double dth = atan2(radius_robot, dist_wall);
+    int d_step = dth/angle_increment;
 
+    //! Check for objects in front of virtual wall
+    bool path_free = true;
+    int j_max = std::min(num_readings, index_beam_target_pos + d_step);
+    for (int j = std::max(index_beam_target_pos - d_step,0); j < j_max; ++j) {
+        double dist_to_obstacle = ranges[j];
+
+        if (dist_to_obstacle > 0.001 && dist_to_obstacle < dist_wall) {
+
+            double angle = angle_min + j * angle_increment;
+            double dy = sin(angle)*dist_to_obstacle;
+            ROS_DEBUG("Object too close: %f [m], dy = %f", dist_to_obstacle, dy);
+            if (blocking_beam) *blocking_beam = j;
+            if (blocking_distance) *blocking_distance = dist_to_obstacle;
+            path_free = false;
+            break;
+        }
+    }
 
-    //double angle_beam_obs = laser_scan_.angle_min + index_beam_target_pos * laser_scan_.angle_increment;
-    //ROS_INFO("Angle beam obstable is %f [deg] or %f [rad]", angle_beam_obs/3.1415*180.0, angle_beam_obs);
-    //ROS_INFO("d_step is %d", d_step);
-    //ROS_INFO("Middle beam has angle %f", laser_scan_.angle_min + num_readings/2 * laser_scan_.angle_increment);
+    return path_free;
+}
 
-    //! For visualizing the virtual wall
+namespace {
+
+//! Clear-line check of a contiguous part of a batch, run on a thread of its own
+struct ClearLineBatch {
+    const float* ranges;
+    int num_scans, num_readings;
+    double angle_min, angle_increment;
+    const double* angle_goals;
+    double dist_wall, radius_robot;
+    bool* path_free;
+
+    void operator()() const {
+        CarrotPlanner::isClearLine(ranges, num_scans, num_readings, angle_min, angle_increment, angle_goals, dist_wall,
+                                   radius_robot, path_free, 1);
+    }
+};
+
+}
+
+void CarrotPlanner::isClearLine(const float* ranges, int num_scans, int num_readings, double angle_min, double angle_increment,
+                                const double* angle_goals, double dist_wall, double radius_robot, bool* path_free,
+                                int num_threads) {
+
+    if (num_threads <= 0) num_threads = std::max(1u, boost::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, num_scans);
+    if (num_threads <= 1) {
+        for (int i = 0; i < num_scans; ++i) {
+            path_free[i] = isClearLine(ranges + (size_t)i * num_readings, num_readings, angle_min, angle_increment,
+                                       angle_goals[i], dist_wall, radius_robot);
+        }
+        return;
+    }
+
+    //! Equal contiguous parts, each written by one thread only
+    boost::thread_group threads;
+    int first = 0;
+    for (int t = 0; t < num_threads; ++t) {
+        ClearLineBatch part;
+        part.ranges = ranges + (size_t)first * num_readings;
+        part.num_scans = (num_scans - first) / (num_threads - t);
+        part.num_readings = num_readings;
+        part.angle_min = angle_min;
+        part.angle_increment = angle_increment;
+        part.angle_goals = angle_goals + first;
+        part.dist_wall = dist_wall;
+        part.radius_robot = radius_robot;
+        part.path_free = path_free + first;
+        threads.create_thread(part);
+        first += part.num_scans;
+    }
+    threads.join_all();
+}
+
+void CarrotPlanner::publishVirtualWall(double angle_goal, ros::Publisher& pub) {
+
+    //! Get number of beams
+    int num_readings = laser_scan_->ranges.size();
+
+    //! Same wedge as in isClearLine
+    int num_incr = angle_goal/laser_scan_->angle_increment;
+    int index_beam_target_pos = std::max(0, num_readings/2 + num_incr);
+    double dth = atan2(radius_robot_.load(), DISTANCE_VIRTUAL_WALL);
+    int d_step = dth/laser_scan_->angle_increment;
+    int j_min = std::max(index_beam_target_pos - d_step,0);
+    int j_max = std::min(num_readings, index_beam_target_pos + d_step);
+
+    //! Only copy the header and geometry of the scan, the ranges are replaced by the wall
     sensor_msgs::LaserScan wall_msg;
-    if (visualization_) {
-        wall_msg = laser_scan_;
-        wall_msg.ranges.clear();
-        wall_msg.intensities.clear();
-        ROS_DEBUG("wall: index beam is %d, d_step is %d, num_readings is %d", index_beam_target_pos, d_step, num_readings);
-        ROS_DEBUG("wall: offsets are %d and %d", std::max(index_beam_target_pos - d_step,0), std::min(num_readings, index_beam_target_pos + d_step));
-        wall_msg.angle_min = laser_scan_.angle_min + std::max(index_beam_target_pos - d_step,0) * laser_scan_.angle_increment;
-        wall_msg.angle_max = laser_scan_.angle_min + std::min(num_readings, index_beam_target_pos + d_step) * laser_scan_.angle_increment;
-        ROS_DEBUG("wall: from angle %f to %f", wall_msg.angle_min, wall_msg.angle_max);
+    wall_msg.header = laser_scan_->header;
+    wall_msg.angle_increment = laser_scan_->angle_increment;
+    wall_msg.time_increment = laser_scan_->time_increment;
+    wall_msg.scan_time = laser_scan_->scan_time;
+    wall_msg.range_min = laser_scan_->range_min;
+    wall_msg.range_max = laser_scan_->range_max;
+    ROS_DEBUG("wall: index beam is %d, d_step is %d, num_readings is %d", index_beam_target_pos, d_step, num_readings);
+    ROS_DEBUG("wall: offsets are %d and %d", j_min, j_max);
+    wall_msg.angle_min = laser_scan_->angle_min + j_min * laser_scan_->angle_increment;
+    wall_msg.angle_max = laser_scan_->angle_min + j_max * laser_scan_->angle_increment;
+    ROS_DEBUG("wall: from angle %f to %f", wall_msg.angle_min, wall_msg.angle_max);
+    if (j_max > j_min) {
+        wall_msg.ranges.assign(j_max - j_min, DISTANCE_VIRTUAL_WALL);
+        wall_msg.intensities.assign(j_max - j_min, 100);
     }
 
-    //! Check for objects in front of virtual wall
-    bool path_free = true;
-    for (int j = std::max(index_beam_target_pos - d_step,0); j < index_beam_target_pos + d_step; ++j) {
-        if (j < num_readings) {
-            double dist_to_obstacle = laser_scan_.ranges[j];
+    pub.publish(wall_msg);
+}
 
-			if (visualization_) {
-				wall_msg.ranges.push_back(DISTANCE_VIRTUAL_WALL);
-				wall_msg.intensities.push_back(100);
-			}
 
-            if (dist_to_obstacle > 0.001 && dist_to_obstacle < DISTANCE_VIRTUAL_WALL) {
 
-                double angle = laser_scan_.angle_min + j * laser_scan_.angle_increment;
-                double dy = sin(angle)*dist_to_obstacle;
-                if (path_free) ROS_DEBUG("Object too close: %f [m], dy = %f", dist_to_obstacle, dy);
-                path_free = false;
+void CarrotPlanner::setLaserScan(const sensor_msgs::LaserScan::ConstPtr& laser_scan){
+
+        laserScanCallBack(laser_scan);
+}
+
+
+double CarrotPlanner::getMinimumClearance() const {
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    //! Distance from the robot edge to the nearest obstacle
+    double clearance = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < obstacles_.size(); ++i) {
+        clearance = std::min(clearance, obstacles_[i].nearest_range - radius_robot_.load());
+    }
+    return clearance;
+}
+
+
+void CarrotPlanner::laserScanCallBack(const sensor_msgs::LaserScan::ConstPtr& laser_scan){
+
+        boost::recursive_mutex::scoped_lock lock(mutex_);
+
+        laser_scan_ = laser_scan;
+        laser_data_available_ = true;
+
+        updateBeamTables(*laser_scan);
+
+        //! Derived structures are only rebuilt if the scan changed since they were last built
+        if (countChangedBlocks(*laser_scan) > 0) {
+            reference_scan_ = laser_scan;
+            segmentScan(*laser_scan);
+            if (velocity_obstacle_avoidance_) trackObstacles(laser_scan->header.stamp.toSec());
+            if (visualization_ && obstacles_pub_.getNumSubscribers() > 0) publishObstacles(obstacles_pub_);
+        } else if (velocity_obstacle_avoidance_) {
+            //! The tracks keep the time of their positions. A track that would have moved more than the
+            //! change threshold since then has stopped.
+            double dt = laser_scan->header.stamp.toSec() - t_last_tracks_;
+            for (size_t i = 0; i < tracks_.size(); ++i) {
+                double speed = sqrt(tracks_[i].vx * tracks_[i].vx + tracks_[i].vy * tracks_[i].vy);
+                if (speed * dt > SCAN_CHANGE_THRESHOLD) tracks_[i].vx = tracks_[i].vy = 0;
             }
         }
+
+        //! Stop immediately if something enters the stop field, independent of the MoveToGoal rate
+        if (protective_stop_ && robot_did_move_ && checkProtectiveStop(last_cmd_vel_)) {
+            ROS_WARN_THROTTLE(1.0, "Obstacle in protective field: stopping");
+            limit_reasons_ = REASON_PROTECTIVE_STOP;
+            freeze();
+            setZeroVelocity(last_cmd_vel_);
+            last_cmd_vel_.angular.z = 0;
+            publishLimitReasons();
+        }
+}
+
+void CarrotPlanner::scanRingIngest() {
+
+    //! Poll the ring on an own thread: a new scan is handled within a poll period of being written, without
+    //! serialization and with a single copy out of the ring
+    ScanRingReader reader;
+    ros::WallTime t_last_scan = ros::WallTime::now();
+    boost::uint64_t num_skipped = 0;
+    while (!scan_ring_stop_) {
+        if (!reader.isOpen()) {
+            if (reader.open(scan_ring_name_)) {
+                t_last_scan = ros::WallTime::now();
+            } else {
+                ROS_WARN_THROTTLE(5.0, "Waiting for shared-memory scan ring %s", scan_ring_name_.c_str());
+            }
+        } else {
+            sensor_msgs::LaserScan::Ptr scan = reader.readLatest();
+            if (scan) {
+                t_last_scan = ros::WallTime::now();
+                laserScanCallBack(scan);
+                if (reader.numSkipped() > num_skipped) {
+                    ROS_WARN_THROTTLE(5.0, "Skipped %d scans from ring %s", (int)(reader.numSkipped() - num_skipped), scan_ring_name_.c_str());
+                    num_skipped = reader.numSkipped();
+                }
+            } else if ((ros::WallTime::now() - t_last_scan).toSec() > SCAN_RING_TIMEOUT) {
+                //! The driver may have restarted with a new ring
+                ROS_WARN_THROTTLE(5.0, "No scans in ring %s for %f [s]: reopening", scan_ring_name_.c_str(), SCAN_RING_TIMEOUT);
+                reader.close();
+            }
+        }
+        boost::this_thread::sleep(boost::posix_time::microseconds((long)(SCAN_RING_POLL_PERIOD * 1e6)));
     }
+}
 
-    if (visualization_) virt_wall_pub_.publish(wall_msg);
+int CarrotPlanner::countChangedBlocks(const sensor_msgs::LaserScan& scan) {
+
+    int num_readings = scan.ranges.size();
+    int num_blocks = (num_readings + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+    if (num_readings == 0) return 0;
+
+    //! Without a reference scan of the same size everything changed
+    if (!reference_scan_ || (int)reference_scan_->ranges.size() != num_readings) return num_blocks;
+
+    //! Per block, the largest range difference with the reference scan, computed without branches
+    const float* ranges = &scan.ranges[0];
+    const float* reference = &reference_scan_->ranges[0];
+    float threshold = SCAN_CHANGE_THRESHOLD;
+    int num_changed = 0;
+    for (int b = 0; b < num_blocks; ++b) {
+        int j_end = std::min(num_readings, (b + 1) * SCAN_BLOCK_SIZE);
+        float max_diff = 0;
+        for (int j = b * SCAN_BLOCK_SIZE; j < j_end; ++j) {
+            max_diff = std::max(max_diff, fabsf(ranges[j] - reference[j]));
+        }
+        num_changed += max_diff > threshold;
+    }
+    ROS_DEBUG("%d of %d scan blocks changed", num_changed, num_blocks);
 
-    return path_free;
+    return num_changed;
 }
 
+void CarrotPlanner::segmentScan(const sensor_msgs::LaserScan& scan) {
+
+    obstacles_.clear();
+    if (beam_cos_.size() != scan.ranges.size()) return;
+
+    //! Adjacent valid beams belong to the same obstacle unless the range jumps
+    ObstacleCluster cluster;
+    bool in_cluster = false;
+    double sum_x = 0, sum_y = 0;
+    int num_readings = scan.ranges.size();
+    for (int j = 0; j <= num_readings; ++j) {
+        float r = (j < num_readings) ? scan.ranges[j] : 0;
+        bool valid = r > 0.001f && r <= scan.range_max;
+
+        //! Close the current cluster
+        if (in_cluster && (!valid || fabs(r - scan.ranges[j - 1]) > CLUSTER_BREAK_DISTANCE)) {
+            int n = cluster.last_beam - cluster.first_beam + 1;
+            cluster.centroid_x = sum_x / n;
+            cluster.centroid_y = sum_y / n;
+            double dx = scan.ranges[cluster.last_beam] * beam_cos_[cluster.last_beam] - scan.ranges[cluster.first_beam] * beam_cos_[cluster.first_beam];
+            double dy = scan.ranges[cluster.last_beam] * beam_sin_[cluster.last_beam] - scan.ranges[cluster.first_beam] * beam_sin_[cluster.first_beam];
+            cluster.extent = sqrt(dx * dx + dy * dy);
+            if ((int)obstacles_.size() < MAX_OBSTACLES) {
+                obstacles_.push_back(cluster);
+            } else if (MAX_OBSTACLES > 0) {
+                //! Keep the nearest obstacles: replace the farthest one if this one is closer
+                ROS_WARN_THROTTLE(1.0, "More than %d obstacles in scan, ignoring the farthest", MAX_OBSTACLES);
+                size_t farthest = 0;
+                for (size_t k = 1; k < obstacles_.size(); ++k) {
+                    if (obstacles_[k].nearest_range > obstacles_[farthest].nearest_range) farthest = k;
+                }
+                if (cluster.nearest_range < obstacles_[farthest].nearest_range) obstacles_[farthest] = cluster;
+            }
+            in_cluster = false;
+        }
+        if (!valid) continue;
+
+        //! Open a new cluster or extend the current one
+        if (!in_cluster) {
+            cluster.first_beam = j;
+            cluster.nearest_beam = j;
+            cluster.nearest_range = r;
+            sum_x = sum_y = 0;
+            in_cluster = true;
+        }
+        cluster.last_beam = j;
+        if (r < cluster.nearest_range) {
+            cluster.nearest_beam = j;
+            cluster.nearest_range = r;
+        }
+        sum_x += r * beam_cos_[j];
+        sum_y += r * beam_sin_[j];
+    }
+}
 
+void CarrotPlanner::trackObstacles(double time) {
+
+    double dt = time - t_last_tracks_;
+    t_last_tracks_ = time;
+    std::vector<TrackedObstacle> tracks;
+    tracks.reserve(obstacles_.size());
+
+    //! Where the previous tracks would be now if they stood still, given the commanded motion of the robot
+    double dx = last_cmd_vel_.linear.x * dt, dy = last_cmd_vel_.linear.y * dt, dth = last_cmd_vel_.angular.z * dt;
+    double c = cos(-dth), s = sin(-dth);
+
+    for (size_t i = 0; i < obstacles_.size(); ++i) {
+        const ObstacleCluster& cluster = obstacles_[i];
+
+        //! Only compact obstacles can move, larger ones are handled by their nearest point
+        if (cluster.extent > TRACK_MAX_EXTENT) continue;
+
+        TrackedObstacle track;
+        track.x = cluster.centroid_x;
+        track.y = cluster.centroid_y;
+        track.vx = track.vy = 0;
+        track.radius = cluster.extent / 2.0;
+
+        //! Associate with the nearest compensated previous track within the gate
+        double best_dist = TRACK_GATE;
+        int best = -1;
+        for (size_t k = 0; k < tracks_.size(); ++k) {
+            double px = c * tracks_[k].x - s * tracks_[k].y - dx;
+            double py = s * tracks_[k].x + c * tracks_[k].y - dy;
+            double dist = sqrt((px - track.x) * (px - track.x) + (py - track.y) * (py - track.y));
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = k;
+            }
+        }
 
-void CarrotPlanner::laserScanCallBack(const sensor_msgs::LaserScan::ConstPtr& laser_scan){
+        //! Velocity from the displacement that is not explained by the robot motion, low-pass filtered
+        if (best >= 0 && dt > 0 && dt < 1.0) {
+            double px = c * tracks_[best].x - s * tracks_[best].y - dx;
+            double py = s * tracks_[best].x + c * tracks_[best].y - dy;
+            double vx_prev = c * tracks_[best].vx - s * tracks_[best].vy;
+            double vy_prev = s * tracks_[best].vx + c * tracks_[best].vy;
+            track.vx = vx_prev + TRACK_VELOCITY_GAIN * ((track.x - px) / dt - vx_prev);
+            track.vy = vy_prev + TRACK_VELOCITY_GAIN * ((track.y - py) / dt - vy_prev);
+        }
+        tracks.push_back(track);
+    }
 
-        laser_scan_ = *laser_scan;
-        laser_data_available_ = true;
+    tracks_.swap(tracks);
+}
+
+void CarrotPlanner::avoidObstacles(double dt, geometry_msgs::Twist& cmd_vel) {
+
+    typedef VelocityObstacles::Vector2 Vector2;
+    double radius_robot = radius_robot_.load();
+    double scan_period = (laser_scan_ && laser_scan_->scan_time > 0) ? laser_scan_->scan_time : 0.1;
+    velocity_obstacles_.reset(radius_robot, Vector2(last_cmd_vel_.linear.x, last_cmd_vel_.linear.y), scan_period);
+
+    //! Moving obstacles share the avoidance, standing ones leave it to the robot
+    for (size_t i = 0; i < tracks_.size(); ++i) {
+        const TrackedObstacle& track = tracks_[i];
+        if (sqrt(track.x * track.x + track.y * track.y) > VO_RANGE) continue;
+        bool moving = sqrt(track.vx * track.vx + track.vy * track.vy) > 0.1;
+        velocity_obstacles_.addObstacle(Vector2(track.x, track.y), Vector2(track.vx, track.vy), track.radius, moving ? VO_RESPONSIBILITY : 1.0);
+    }
+
+    //! Large obstacles (walls) as a chain of touching discs along their beams
+    double spacing = radius_robot / 2.0;
+    for (size_t i = 0; i < obstacles_.size(); ++i) {
+        const ObstacleCluster& cluster = obstacles_[i];
+        if (cluster.extent <= TRACK_MAX_EXTENT || cluster.nearest_range > VO_RANGE) continue;
+        double last_x = 0, last_y = 0;
+        bool first = true;
+        for (int j = cluster.first_beam; j <= cluster.last_beam; ++j) {
+            float r = laser_scan_->ranges[j];
+            if (r > VO_RANGE) continue;
+            double x = r * beam_cos_[j], y = r * beam_sin_[j];
+            if (!first && (x - last_x) * (x - last_x) + (y - last_y) * (y - last_y) < spacing * spacing && j != cluster.last_beam) continue;
+            velocity_obstacles_.addObstacle(Vector2(x, y), Vector2(), spacing / 2.0, 1.0);
+            last_x = x;
+            last_y = y;
+            first = false;
+        }
+    }
+
+    //! Closest velocity to the preferred one outside all velocity obstacles, no faster than the planner already allows
+    double speed = sqrt(cmd_vel.linear.x * cmd_vel.linear.x + cmd_vel.linear.y * cmd_vel.linear.y);
+    Vector2 result;
+    if (!velocity_obstacles_.solve(Vector2(cmd_vel.linear.x, cmd_vel.linear.y), speed, result)) {
+        ROS_DEBUG("No collision free velocity: stop translation");
+        result = Vector2();
+    }
+    if (result.x == cmd_vel.linear.x && result.y == cmd_vel.linear.y) return;
+
+    //! Only accept a new direction if it passes the same checks as the planner command and the startup ramp allows sideways
+    //! motion; otherwise only slow down along the planner command
+    double result_speed = sqrt(result.x * result.x + result.y * result.y);
+    tf::Vector3 direction(result.x, result.y, 0);
+    bool accept = scaling_factor_safety_ >= 1.0 && result_speed > 1e-6 &&
+            isClearLine(*laser_scan_, atan2(result.y, result.x), DISTANCE_VIRTUAL_WALL, radius_robot) &&
+            (!costmap_available_ || isClearCostmap(*costmap_dt_, costmap_info_, direction, DISTANCE_VIRTUAL_WALL));
+    if (!accept && speed > 1e-6) {
+        double along = std::max(0.0, std::min(speed, (result.x * cmd_vel.linear.x + result.y * cmd_vel.linear.y) / speed));
+        result = Vector2(cmd_vel.linear.x * along / speed, cmd_vel.linear.y * along / speed);
+    }
+
+    //! The change of velocity is bounded by the acceleration limit as well
+    double dx = result.x - last_cmd_vel_.linear.x, dy = result.y - last_cmd_vel_.linear.y;
+    double dv = sqrt(dx * dx + dy * dy);
+    if (dt > 0 && dv > acc_lin_ * dt) {
+        result = Vector2(last_cmd_vel_.linear.x + dx / dv * acc_lin_ * dt, last_cmd_vel_.linear.y + dy / dv * acc_lin_ * dt);
+        limit_reasons_ |= REASON_ACC_LIMIT;
+    }
+
+    ROS_DEBUG("Velocity obstacles changed (%f,%f) into (%f,%f)", cmd_vel.linear.x, cmd_vel.linear.y, result.x, result.y);
+    limit_reasons_ |= REASON_VELOCITY_OBSTACLE;
+    cmd_vel.linear.x = result.x;
+    cmd_vel.linear.y = result.y;
+}
+
+void CarrotPlanner::publishObstacles(ros::Publisher& pub) {
+
+    //! One line per obstacle, from its first to its last beam
+    visualization_msgs::Marker marker;
+    marker.header = laser_scan_->header;
+    marker.ns = "obstacles";
+    marker.type = visualization_msgs::Marker::LINE_LIST;
+    marker.scale.x = 0.03;
+    marker.color.r = 1;
+    marker.color.g = 0;
+    marker.color.b = 1;
+    marker.color.a = 1;
+    marker.action = visualization_msgs::Marker::ADD;
+    marker.pose.orientation.w = 1.0;
+    marker.lifetime = ros::Duration(0.0);
+    for (size_t i = 0; i < obstacles_.size(); ++i) {
+        geometry_msgs::Point p1, p2;
+        int j1 = obstacles_[i].first_beam, j2 = obstacles_[i].last_beam;
+        p1.x = laser_scan_->ranges[j1] * beam_cos_[j1];
+        p1.y = laser_scan_->ranges[j1] * beam_sin_[j1];
+        p2.x = laser_scan_->ranges[j2] * beam_cos_[j2];
+        p2.y = laser_scan_->ranges[j2] * beam_sin_[j2];
+        marker.points.push_back(p1);
+        marker.points.push_back(p2);
+    }
+    pub.publish(marker);
+}
+
+void CarrotPlanner::updateBeamTables(const sensor_msgs::LaserScan& scan) {
+
+    //! Only rebuild if the scanner geometry changed
+    if (beam_cos_.size() == scan.ranges.size() && beam_angle_min_ == scan.angle_min && beam_angle_increment_ == scan.angle_increment) return;
+
+    beam_angle_min_ = scan.angle_min;
+    beam_angle_increment_ = scan.angle_increment;
+    beam_cos_.resize(scan.ranges.size());
+    beam_sin_.resize(scan.ranges.size());
+    for (size_t j = 0; j < scan.ranges.size(); ++j) {
+        double angle = scan.angle_min + j * scan.angle_increment;
+        beam_cos_[j] = cos(angle);
+        beam_sin_[j] = sin(angle);
+    }
+}
+
+bool CarrotPlanner::isProtectiveFieldViolated(const sensor_msgs::LaserScan& scan, const geometry_msgs::Twist& cmd_vel) const {
+
+    //! The field is a rectangle in the direction of motion, long enough to brake from the commanded speed
+    double speed = sqrt(cmd_vel.linear.x * cmd_vel.linear.x + cmd_vel.linear.y * cmd_vel.linear.y);
+    if (speed < 1e-3 || scan.ranges.empty()) return false;
+    float dir_x = cmd_vel.linear.x / speed;
+    float dir_y = cmd_vel.linear.y / speed;
+    float width = radius_robot_.load();
+    float length = width + speed * speed / (2 * MAX_ACC) + PROTECTIVE_STOP_MARGIN;
+
+    //! Branch-free loop over all beams, so the compiler can vectorize it
+    const float* ranges = &scan.ranges[0];
+    const float* c = &beam_cos_[0];
+    const float* s = &beam_sin_[0];
+    int num_readings = scan.ranges.size();
+    int violations = 0;
+    for (int j = 0; j < num_readings; ++j) {
+        float x = ranges[j] * c[j];
+        float y = ranges[j] * s[j];
+        float along = x * dir_x + y * dir_y;
+        float lateral = y * dir_x - x * dir_y;
+        violations += (ranges[j] > 0.001f) & (along > 0) & (along < length) & (fabsf(lateral) < width);
+    }
+
+    return violations > 0;
+}
+
+bool CarrotPlanner::checkProtectiveStop(const geometry_msgs::Twist& cmd_vel) {
+
+    if (!protective_stop_ || !laser_data_available_) return false;
+
+    if (isProtectiveFieldViolated(scanWithoutDockFace(*laser_scan_), cmd_vel)) {
+        protective_stop_latched_ = true;
+        protective_stop_scan_ = laser_scan_;
+    } else if (protective_stop_latched_ && laser_scan_ != protective_stop_scan_) {
+        //! Only a scan taken after the stop can release it
+        ROS_INFO("Protective field clear: stop released");
+        protective_stop_latched_ = false;
+        protective_stop_scan_.reset();
+    }
+
+    return protective_stop_latched_;
 }
 
 
@@ -300,7 +1673,12 @@ void CarrotPlanner::determineDesiredVelocity(double dt, geometry_msgs::Twist &cm
     //! Determine normalized velocity
     double v_desired_norm = 0;
     if (error_lin_norm > 0) {
-        v_desired_norm = std::min(MAX_VEL, GAIN * sqrt(2 * error_lin_norm * MAX_ACC));
+        v_desired_norm = std::min(MAX_VEL, GAIN * sqrt(2 * error_lin_norm * acc_lin_));
+        if (v_desired_norm >= MAX_VEL) limit_reasons_ |= REASON_MAX_VEL;
+        if (v_desired_norm > speed_zone_limit_) {
+            v_desired_norm = speed_zone_limit_;
+            limit_reasons_ |= REASON_SPEED_ZONE;
+        }
         ROS_DEBUG(" updated v_wanted_norm to %f", v_desired_norm);
     } else {
         ROS_DEBUG(" zeros normalized error: v_wanted_norm is 0 too");
@@ -325,6 +1703,7 @@ void CarrotPlanner::determineDesiredVelocity(double dt, geometry_msgs::Twist &cm
     if (scaling_factor_safety_ < 1.0)
     {
 		ROS_DEBUG("Use scaling to force the acceleration to be low!");
+		limit_reasons_ |= REASON_STARTUP_RAMP;
 		// Perform the actual scaling: only allow drivinf forward to reduce slip!)
 		vel_desired.setX(scaling_factor_safety_*vel_desired.getX());
 		vel_desired.setY(0);
@@ -335,15 +1714,24 @@ void CarrotPlanner::determineDesiredVelocity(double dt, geometry_msgs::Twist &cm
     tf::Vector3 vel_diff = vel_desired - current_vel_trans;
     double acc_desired = vel_diff.length() / dt;
     ROS_DEBUG(" vel_diff = (%f,%f,%f), acc_desired = %f", vel_diff.getX(), vel_diff.getY(), vel_diff.getZ(), acc_desired);
-    if (acc_desired > MAX_ACC) {
-        tf::vector3TFToMsg(current_vel_trans + vel_diff.normalized() * MAX_ACC * dt, cmd_vel.linear);
+    if (acc_desired > acc_lin_) {
+        limit_reasons_ |= REASON_ACC_LIMIT;
+        tf::vector3TFToMsg(current_vel_trans + vel_diff.normalized() * acc_lin_ * dt, cmd_vel.linear);
     } else {
 
         //! P-action: scale velocity with distance
         double distance = sqrt(error_lin.getX()*error_lin.getX() + error_lin.getY()*error_lin.getY());
-        vel_desired = std::min(vel_desired, distance * 2.0/3.0 * vel_desired);
+        if (docking_) {
+            //! Docking profile: proportional with a minimum creep speed and a stop tolerance, to converge quickly
+            double v = vel_desired.length();
+            double v_dock = (distance < DOCKING_TOLERANCE) ? 0 : std::min(v, std::max(DOCKING_GAIN * distance, DOCKING_MIN_VEL));
+            if (v > 0) vel_desired *= v_dock / v;
+        } else {
+            vel_desired *= std::min(distance * 2.0/3.0, 1.0);
+        }
         tf::vector3TFToMsg(vel_desired, cmd_vel.linear);
         if (std::min(distance * 2.0/3.0, 1.0) < 1.0) {
+            limit_reasons_ |= REASON_GOAL_DISTANCE;
             ROS_DEBUG("Lowered velocity by a factor %f", std::min(distance * 2.0/3.0, 1.0));
         }
     }
@@ -351,14 +1739,14 @@ void CarrotPlanner::determineDesiredVelocity(double dt, geometry_msgs::Twist &cm
     //! The rotation is always controlled
     cmd_vel.angular.x = 0;
     cmd_vel.angular.y = 0;
-    cmd_vel.angular.z = determineReference(error_ang, current_vel.angular.z, MAX_VEL_THETA, MAX_ACC_THETA, dt);
+    cmd_vel.angular.z = determineReference(error_ang, current_vel.angular.z, MAX_VEL_THETA, acc_rot_, dt);
 
     //! P-action: scale angular velocity with distance
     double angular_vel_calc = cmd_vel.angular.z;
     cmd_vel.angular.z = std::min(fabs(angular_vel_calc), fabs(error_ang*10.0/3.1415*angular_vel_calc));
     
-    //! Minimum angular velocity: otherwise ignoring small angles
-    cmd_vel.angular.z = std::max(cmd_vel.angular.z, MIN_VEL_THETA);
+    //! Minimum angular velocity: otherwise ignoring small angles (an angle that is exactly zero needs no rotation)
+    if (error_ang != 0) cmd_vel.angular.z = std::max(cmd_vel.angular.z, MIN_VEL_THETA);
     
     if (angular_vel_calc < 0) cmd_vel.angular.z *= -1;
     ROS_DEBUG("Adapted angular velocity from %f to %f for theta is %f", angular_vel_calc, cmd_vel.angular.z, goal_angle_);
@@ -375,6 +1763,26 @@ void CarrotPlanner::determineDesiredVelocity(double dt, geometry_msgs::Twist &cm
 	}
 }
 
+void CarrotPlanner::limitLateralAcceleration(double dt, geometry_msgs::Twist& cmd_vel) {
+
+    //! Combined constraint: the centripetal acceleration |v*w| may not exceed MAX_ACC_LATERAL
+    double v = sqrt(cmd_vel.linear.x * cmd_vel.linear.x + cmd_vel.linear.y * cmd_vel.linear.y);
+    double w = fabs(cmd_vel.angular.z);
+    double acc_lateral = v * w;
+    if (MAX_ACC_LATERAL <= 0 || acc_lateral <= MAX_ACC_LATERAL) return;
+    limit_reasons_ |= REASON_LATERAL_ACC;
+
+    //! Slow down, but not harder than the acceleration limit allows
+    double v_last = sqrt(last_cmd_vel_.linear.x * last_cmd_vel_.linear.x + last_cmd_vel_.linear.y * last_cmd_vel_.linear.y);
+    double v_new = std::min(v, std::max(MAX_ACC_LATERAL / w, v_last - acc_lin_ * dt));
+    cmd_vel.linear.x *= v_new / v;
+    cmd_vel.linear.y *= v_new / v;
+
+    //! Turn slower for what braking cannot take
+    if (v_new * w > MAX_ACC_LATERAL) cmd_vel.angular.z = sign(cmd_vel.angular.z) * MAX_ACC_LATERAL / v_new;
+    ROS_DEBUG("Lateral acceleration %f too high: (v,w) from (%f,%f) to (%f,%f)", acc_lateral, v, w, v_new, cmd_vel.angular.z);
+}
+
 // PARTLY TAKEN FROM amigo_ref_interpolator
 double CarrotPlanner::determineReference(double error_x, double vel, double max_vel, double max_acc, double dt) {
     double EPS = 0.5 * max_acc*dt;
@@ -479,6 +1887,126 @@ void CarrotPlanner::setZeroVelocity(geometry_msgs::Twist& cmd_vel) {
     cmd_vel.linear.z = 0;
 }
 
+void CarrotPlanner::odomCallBack(const nav_msgs::Odometry::ConstPtr& odom) {
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    //! Only stored: the limits are adapted once per control cycle, independent of the odometry rate
+    odom_vel_ = odom->twist.twist;
+    t_odom_ = odom->header.stamp.toSec();
+}
+
+void CarrotPlanner::adaptAccelerationLimits(const geometry_msgs::Twist& cmd_vel, double time) {
+
+    //! The velocity change commanded in the previous cycle should show in the odometry over this cycle
+    double dt_meas = t_odom_ - t_cycle_odom_;
+    if (t_cycle_odom_ > 0 && dt_cmd_vel_change_ > 0 && fabs(dt_meas - dt_cmd_vel_change_) < 0.5 * dt_cmd_vel_change_) {
+
+        //! Only the measured change along the commanded one counts, and only commanded changes above the odometry noise
+        double cmd_dx = cmd_vel_change_.linear.x, cmd_dy = cmd_vel_change_.linear.y;
+        double cmd_dv = sqrt(cmd_dx * cmd_dx + cmd_dy * cmd_dy);
+        if (cmd_dv > ACC_NOISE_FLOOR) {
+            double meas_dv = ((odom_vel_.linear.x - cycle_odom_vel_.linear.x) * cmd_dx + (odom_vel_.linear.y - cycle_odom_vel_.linear.y) * cmd_dy) / cmd_dv;
+            acc_lin_ = adaptAcceleration(acc_lin_, MAX_ACC, MAX_ACC_LIMIT, cmd_dv / dt_cmd_vel_change_, meas_dv / dt_meas);
+        }
+        double cmd_dw = cmd_vel_change_.angular.z;
+        if (fabs(cmd_dw) > ACC_NOISE_FLOOR) {
+            double meas_dw = (odom_vel_.angular.z - cycle_odom_vel_.angular.z) * sign(cmd_dw);
+            acc_rot_ = adaptAcceleration(acc_rot_, MAX_ACC_THETA, MAX_ACC_THETA_LIMIT, fabs(cmd_dw) / dt_cmd_vel_change_, meas_dw / dt_meas);
+        }
+        ROS_DEBUG("Acceleration limits: %f, %f (commanded change %f, %f over %f [s])", acc_lin_, acc_rot_, cmd_dv, cmd_dw, dt_cmd_vel_change_);
+    }
+
+    //! Commanded change of this cycle, over the time since the previous cycle
+    cmd_vel_change_.linear.x = cmd_vel.linear.x - last_cmd_vel_.linear.x;
+    cmd_vel_change_.linear.y = cmd_vel.linear.y - last_cmd_vel_.linear.y;
+    cmd_vel_change_.angular.z = cmd_vel.angular.z - last_cmd_vel_.angular.z;
+    dt_cmd_vel_change_ = (t_cycle_ > 0) ? time - t_cycle_ : 0;
+    t_cycle_ = time;
+    cycle_odom_vel_ = odom_vel_;
+    t_cycle_odom_ = t_odom_;
+}
+
+double CarrotPlanner::adaptAcceleration(double acc, double acc_min, double acc_max, double acc_cmd, double acc_meas) {
+
+    //! Only learn while the planner is accelerating at its current limit
+    if (acc_cmd < 0.9 * acc) return acc;
+
+    if (acc_meas >= 0.9 * acc_cmd) {
+        //! The base keeps up: raise the limit slowly
+        acc = std::min(acc_max, acc * (1 + ACC_ADAPTATION_RATE));
+    } else if (acc_meas < 0.7 * acc_cmd) {
+        //! The base lags (slip, payload): fall back quickly towards the worst-case limit
+        acc = std::max(acc_min, acc_min + 0.5 * (acc - acc_min));
+    }
+
+    return acc;
+}
+
+void CarrotPlanner::publishLimitReasons() {
+
+    std_msgs::Float64MultiArray msg;
+    msg.data.resize(3);
+    msg.data[0] = limit_reasons_;
+    msg.data[1] = blocking_beam_;
+    msg.data[2] = blocking_distance_;
+    limit_reasons_pub_.publish(msg);
+}
+
+void CarrotPlanner::publishCmdVel(const geometry_msgs::Twist& cmd_vel, ros::Publisher& pub, const ros::Time& now, bool allow_override) {
+
+    //! An active override input replaces the planner command, unless the planner requested a stop
+    const geometry_msgs::Twist* command = &cmd_vel;
+    int active = allow_override ? activeOverride(now) : -1;
+    if (active >= 0) {
+        ROS_DEBUG("Command overridden by %s input", override_inputs_[active].name.c_str());
+        limit_reasons_ |= REASON_OVERRIDE;
+        command = &override_inputs_[active].cmd_vel;
+    }
+
+    //! The protective stop outranks every input
+    if (checkProtectiveStop(*command)) {
+        ROS_DEBUG("Protective stop latched: publishing zero");
+        limit_reasons_ |= REASON_PROTECTIVE_STOP;
+        published_cmd_vel_ = geometry_msgs::Twist();
+        pub.publish(published_cmd_vel_);
+        return;
+    }
+
+    published_cmd_vel_ = *command;
+    pub.publish(*command);
+}
+
+int CarrotPlanner::activeOverride(const ros::Time& now) const {
+
+    //! An input from the future (the clock jumped back) has expired as well
+    for (size_t i = 0; i < override_inputs_.size(); ++i) {
+        if (override_inputs_[i].stamp.isZero()) continue;
+        double age = (now - override_inputs_[i].stamp).toSec();
+        if (age >= 0 && age < OVERRIDE_TIMEOUT) return i;
+    }
+    return -1;
+}
+
+void CarrotPlanner::overrideCallBack(const geometry_msgs::Twist::ConstPtr& cmd_vel, size_t index) {
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    ros::Time now = clockNow();
+    override_inputs_[index].cmd_vel = *cmd_vel;
+    override_inputs_[index].stamp = now;
+
+    //! Forward right away if this input wins, instead of waiting for the next planner cycle
+    if (activeOverride(now) == (int)index) publishCmdVel(*cmd_vel, cmd_vel_pub_, now);
+}
+
+ros::Time CarrotPlanner::clockNow() const {
+
+    //! The ROS clock shifted onto the clock of the control cycle; the same as the ROS clock unless a caller drives
+    //! MoveToGoal with its own clock
+    return ros::Time(std::max(0.0, ros::Time::now().toSec() + clock_offset_));
+}
+
 void CarrotPlanner::publishCarrot(const tf::Vector3& carrot, ros::Publisher& pub) {
 
     //! Create a marker message for the plan
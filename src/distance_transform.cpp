@@ -0,0 +1,85 @@
+#include "tue_carrot_planner/distance_transform.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+const float INF = 1e20f;
+}
+
+DistanceTransform::DistanceTransform() : width_(0), height_(0) {
+}
+
+void DistanceTransform::update(const std::vector<bool>& occupied, int width, int height) {
+
+    //! A change of geometry invalidates all cached columns
+    bool full_update = (width != width_ || height != height_ || occupied_.size() != occupied.size());
+    if (full_update) {
+        width_ = width;
+        height_ = height;
+        column_dt_.assign(width * height, INF);
+        distance_.assign(width * height, INF);
+        int n = std::max(width, height);
+        f_.resize(n);
+        d_.resize(n);
+        z_.resize(n + 1);
+        v_.resize(n);
+    }
+
+    //! Column pass, only for columns with changed occupancy
+    int columns_updated = 0;
+    for (int x = 0; x < width_; ++x) {
+        bool changed = full_update;
+        for (int y = 0; y < height_ && !changed; ++y) {
+            changed = (occupied[y * width_ + x] != occupied_[y * width_ + x]);
+        }
+        if (!changed) continue;
+
+        for (int y = 0; y < height_; ++y) {
+            f_[y] = occupied[y * width_ + x] ? 0 : INF;
+        }
+        transform1D(&f_[0], height_, &d_[0]);
+        for (int y = 0; y < height_; ++y) {
+            column_dt_[y * width_ + x] = d_[y];
+        }
+        ++columns_updated;
+    }
+    occupied_ = occupied;
+
+    if (columns_updated == 0) return;
+
+    //! Row pass over the whole grid
+    for (int y = 0; y < height_; ++y) {
+        transform1D(&column_dt_[y * width_], width_, &d_[0]);
+        for (int x = 0; x < width_; ++x) {
+            distance_[y * width_ + x] = sqrt(d_[x]);
+        }
+    }
+}
+
+void DistanceTransform::transform1D(const float* f, int n, float* d) {
+
+    //! Lower envelope of the parabolas rooted at the samples of f
+    int k = 0;
+    v_[0] = 0;
+    z_[0] = -INF;
+    z_[1] = INF;
+    for (int q = 1; q < n; ++q) {
+        float fq = f[q];
+        float s = ((fq + q * q) - (f[v_[k]] + v_[k] * v_[k])) / (2 * q - 2 * v_[k]);
+        while (s <= z_[k]) {
+            --k;
+            s = ((fq + q * q) - (f[v_[k]] + v_[k] * v_[k])) / (2 * q - 2 * v_[k]);
+        }
+        ++k;
+        v_[k] = q;
+        z_[k] = s;
+        z_[k + 1] = INF;
+    }
+
+    //! Sample the envelope
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z_[k + 1] < q) ++k;
+        d[q] = (q - v_[k]) * (q - v_[k]) + f[v_[k]];
+    }
+}
@@ -0,0 +1,148 @@
+//! Python bindings to the clear-line kernel of the carrot planner, for offline analysis of recorded scans with the
+//! production code. Arrays are passed through the buffer protocol, so NumPy arrays are read and written in place, and
+//! the batch is evaluated with the interpreter lock released:
+//!
+//!   import numpy as np, tue_carrot_planner_core as core
+//!   ranges = np.asarray(ranges, dtype=np.float32)           # num_scans x num_readings, C-contiguous
+//!   free = np.empty(len(ranges), dtype=bool)
+//!   core.is_clear_line(ranges, angle_min, angle_increment, angle_goals, 0.65, 0.5, out=free)
+//!
+//! determineDesiredVelocity is not bound: it depends on the state of a running planner (acceleration limits, startup
+//! ramp, odometry) and is covered by the golden trajectories instead.
+
+#include <Python.h>
+#include <vector>
+#include "tue_carrot_planner/carrot_planner.h"
+
+namespace {
+
+//! Buffer view that is released when it goes out of scope
+class BufferView {
+
+public:
+
+    BufferView() : valid_(false) {}
+
+    ~BufferView() {
+        if (valid_) PyBuffer_Release(&view_);
+    }
+
+    bool get(PyObject* object, int flags) {
+        valid_ = PyObject_GetBuffer(object, &view_, flags) == 0;
+        return valid_;
+    }
+
+    Py_buffer& view() {
+        return view_;
+    }
+
+private:
+
+    Py_buffer view_;
+    bool valid_;
+
+};
+
+//! Whether the items of the view are of the given struct type in native byte order
+bool hasType(const Py_buffer& view, char type, size_t size) {
+    const char* format = view.format ? view.format : "B";
+    if (*format == '@' || *format == '=' || (*format == '<' && PY_LITTLE_ENDIAN) || (*format == '>' && !PY_LITTLE_ENDIAN)) ++format;
+    return format[0] == type && format[1] == 0 && (size_t)view.itemsize == size;
+}
+
+PyObject* isClearLine(PyObject*, PyObject* args, PyObject* kwargs) {
+
+    static const char* keywords[] = {"ranges", "angle_min", "angle_increment", "angle_goals", "dist_wall", "radius_robot",
+                                     "out", "num_threads", 0};
+    PyObject* ranges_object = 0;
+    PyObject* angle_goals_object = 0;
+    PyObject* out_object = Py_None;
+    double angle_min, angle_increment, dist_wall, radius_robot;
+    int num_threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OddOdd|Oi", const_cast<char**>(keywords), &ranges_object, &angle_min,
+                                     &angle_increment, &angle_goals_object, &dist_wall, &radius_robot, &out_object, &num_threads)) {
+        return 0;
+    }
+
+    //! Ranges: one scan, or one scan per row
+    BufferView ranges;
+    if (!ranges.get(ranges_object, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)) return 0;
+    if (!hasType(ranges.view(), 'f', sizeof(float)) || ranges.view().ndim < 1 || ranges.view().ndim > 2) {
+        PyErr_SetString(PyExc_TypeError, "ranges must be a C-contiguous float32 array of 1 or 2 dimensions");
+        return 0;
+    }
+    Py_ssize_t num_scans = (ranges.view().ndim == 2) ? ranges.view().shape[0] : 1;
+    Py_ssize_t num_readings = ranges.view().shape[ranges.view().ndim - 1];
+
+    //! Goal angles: one per scan, or a single angle for all scans
+    BufferView angle_goals;
+    std::vector<double> angle_goal_all;
+    const double* angle_goals_data = 0;
+    if (!PyObject_CheckBuffer(angle_goals_object)) {
+        double angle_goal = PyFloat_AsDouble(angle_goals_object);
+        if (PyErr_Occurred()) return 0;
+        angle_goal_all.assign(num_scans, angle_goal);
+        angle_goals_data = angle_goal_all.empty() ? 0 : &angle_goal_all[0];
+    } else {
+        if (!angle_goals.get(angle_goals_object, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)) return 0;
+        if (!hasType(angle_goals.view(), 'd', sizeof(double)) || angle_goals.view().ndim != 1 ||
+            angle_goals.view().shape[0] != num_scans) {
+            PyErr_SetString(PyExc_TypeError, "angle_goals must be a float or a float64 array with one angle per scan");
+            return 0;
+        }
+        angle_goals_data = static_cast<const double*>(angle_goals.view().buf);
+    }
+
+    //! Result: written into out if given, else into a new bytearray
+    PyObject* result = (out_object == Py_None) ? PyByteArray_FromStringAndSize(0, num_scans) : out_object;
+    if (!result) return 0;
+    if (out_object != Py_None) Py_INCREF(result);
+    BufferView out;
+    if (!out.get(result, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE | PyBUF_FORMAT)) {
+        Py_DECREF(result);
+        return 0;
+    }
+    if (!(hasType(out.view(), '?', sizeof(bool)) || hasType(out.view(), 'B', sizeof(bool))) || out.view().len != num_scans) {
+        Py_DECREF(result);
+        PyErr_SetString(PyExc_TypeError, "out must be a writable bool array with one element per scan");
+        return 0;
+    }
+
+    const float* ranges_data = static_cast<const float*>(ranges.view().buf);
+    bool* path_free = static_cast<bool*>(out.view().buf);
+    Py_BEGIN_ALLOW_THREADS
+    CarrotPlanner::isClearLine(ranges_data, num_scans, num_readings, angle_min, angle_increment, angle_goals_data, dist_wall,
+                               radius_robot, path_free, num_threads);
+    Py_END_ALLOW_THREADS
+
+    return result;
+}
+
+PyMethodDef methods[] = {
+    {"is_clear_line", (PyCFunction)(void (*)(void))isClearLine, METH_VARARGS | METH_KEYWORDS,
+     "is_clear_line(ranges, angle_min, angle_increment, angle_goals, dist_wall, radius_robot, out=None, num_threads=0)\n\n"
+     "Clear-line check of CarrotPlanner for each scan (row) of ranges towards its goal angle. Returns out, or a new\n"
+     "bytearray of booleans. num_threads=0 uses one thread per core."},
+    {0, 0, 0, 0}
+};
+
+}
+
+#if PY_MAJOR_VERSION >= 3
+
+namespace {
+PyModuleDef module = {PyModuleDef_HEAD_INIT, "tue_carrot_planner_core", "Clear-line kernel of the carrot planner", -1, methods,
+                      0, 0, 0, 0};
+}
+
+PyMODINIT_FUNC PyInit_tue_carrot_planner_core() {
+    return PyModule_Create(&module);
+}
+
+#else
+
+PyMODINIT_FUNC inittue_carrot_planner_core() {
+    Py_InitModule3("tue_carrot_planner_core", methods, "Clear-line kernel of the carrot planner");
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include "tue_carrot_planner/scan_dataset.h"
+#include <ros/ros.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char DATASET_MAGIC[8] = {'T', 'C', 'P', 'S', 'C', 'A', 'N', 0};
+const boost::uint32_t DATASET_VERSION = 1;
+const size_t ALIGNMENT = 64;
+
+size_t aligned(size_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+//! Pad the file with zeros up to the next column boundary, returns the offset of the column
+boost::uint64_t alignFile(FILE* file) {
+    static const char zeros[ALIGNMENT] = {0};
+    off_t offset = ftello(file);
+    size_t padding = aligned(offset) - offset;
+    if (padding > 0) fwrite(zeros, 1, padding, file);
+    return offset + padding;
+}
+
+}
+
+ScanDatasetWriter::ScanDatasetWriter() : file_(0), num_readings_(0) {
+}
+
+ScanDatasetWriter::~ScanDatasetWriter() {
+    close();
+}
+
+bool ScanDatasetWriter::open(const std::string& filename, int num_readings) {
+
+    close();
+    file_ = fopen(filename.c_str(), "wb");
+    if (!file_) {
+        ROS_ERROR("Cannot open scan dataset %s: %s", filename.c_str(), strerror(errno));
+        return false;
+    }
+    num_readings_ = num_readings;
+    stamps_.clear();
+    angle_goals_.clear();
+    geometry_.clear();
+
+    //! Placeholder header, rewritten by close
+    ScanDatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, file_);
+    alignFile(file_);
+    return true;
+}
+
+bool ScanDatasetWriter::append(const sensor_msgs::LaserScan& scan, double angle_goal) {
+
+    if (!file_ || (int)scan.ranges.size() != num_readings_) return false;
+    if (num_readings_ > 0 && fwrite(&scan.ranges[0], sizeof(float), num_readings_, file_) != (size_t)num_readings_) {
+        ROS_ERROR_THROTTLE(1.0, "Cannot write scan dataset: %s", strerror(errno));
+        return false;
+    }
+    stamps_.push_back(scan.header.stamp.toSec());
+    angle_goals_.push_back(angle_goal);
+    geometry_.push_back(scan.angle_min);
+    geometry_.push_back(scan.angle_increment);
+    geometry_.push_back(scan.range_min);
+    geometry_.push_back(scan.range_max);
+    return true;
+}
+
+bool ScanDatasetWriter::close() {
+
+    if (!file_) return false;
+
+    ScanDatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+    header.version = DATASET_VERSION;
+    header.num_readings = num_readings_;
+    header.num_scans = stamps_.size();
+    header.ranges_offset = aligned(sizeof(ScanDatasetHeader));
+
+    //! The small columns after the ranges
+    header.stamps_offset = alignFile(file_);
+    if (!stamps_.empty()) fwrite(&stamps_[0], sizeof(double), stamps_.size(), file_);
+    header.angle_goals_offset = alignFile(file_);
+    if (!angle_goals_.empty()) fwrite(&angle_goals_[0], sizeof(float), angle_goals_.size(), file_);
+    header.geometry_offset = alignFile(file_);
+    if (!geometry_.empty()) fwrite(&geometry_[0], sizeof(float), geometry_.size(), file_);
+
+    fseeko(file_, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file_);
+    bool ok = !ferror(file_);
+    ok &= fclose(file_) == 0;
+    file_ = 0;
+    if (!ok) ROS_ERROR("Cannot write scan dataset: %s", strerror(errno));
+    return ok;
+}
+
+ScanDatasetReader::ScanDatasetReader() : memory_(0), size_(0), header_(0) {
+}
+
+ScanDatasetReader::~ScanDatasetReader() {
+    close();
+}
+
+bool ScanDatasetReader::open(const std::string& filename) {
+
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ROS_ERROR("Cannot open scan dataset %s: %s", filename.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ScanDatasetHeader)) {
+        memory = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        ROS_ERROR("Cannot map scan dataset %s", filename.c_str());
+        return false;
+    }
+
+    //! Every column must lie within the file
+    const ScanDatasetHeader* header = static_cast<const ScanDatasetHeader*>(memory);
+    boost::uint64_t n = header->num_scans;
+    boost::uint64_t size = st.st_size;
+    bool valid = memcmp(header->magic, DATASET_MAGIC, sizeof(header->magic)) == 0 && header->version == DATASET_VERSION &&
+                 header->ranges_offset + n * header->num_readings * sizeof(float) <= size &&
+                 header->stamps_offset + n * sizeof(double) <= size &&
+                 header->angle_goals_offset + n * sizeof(float) <= size &&
+                 header->geometry_offset + n * 4 * sizeof(float) <= size;
+    if (!valid) {
+        ROS_ERROR("%s is not a complete scan dataset", filename.c_str());
+        munmap(memory, st.st_size);
+        return false;
+    }
+
+    //! Read front to back by the evaluators
+    madvise(memory, st.st_size, MADV_SEQUENTIAL);
+    memory_ = static_cast<const char*>(memory);
+    size_ = st.st_size;
+    header_ = header;
+    return true;
+}
+
+void ScanDatasetReader::close() {
+    if (!memory_) return;
+    munmap(const_cast<char*>(memory_), size_);
+    memory_ = 0;
+    header_ = 0;
+}
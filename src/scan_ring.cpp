@@ -0,0 +1,261 @@
+#include "tue_carrot_planner/scan_ring.h"
+#include <ros/ros.h>
+#include <boost/atomic.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const boost::uint32_t RING_MAGIC = 0x53434e52; // "SCNR"
+const boost::uint32_t RING_VERSION = 1;
+const int FRAME_ID_SIZE = 64;
+
+//! Attempts to copy a slot that the writer keeps overwriting, before giving up until the next poll
+const int MAX_READ_ATTEMPTS = 3;
+
+//! Start of the ring. The magic number is written last, so a reader never sees a half-initialized ring.
+struct RingHeader {
+    boost::atomic<boost::uint32_t> magic;
+    boost::uint32_t version;
+    boost::uint32_t num_slots;
+    boost::uint32_t max_readings;
+    boost::atomic<boost::uint64_t> num_written;
+};
+
+//! Start of a slot, followed by max_readings floats of ranges
+struct SlotHeader {
+    boost::atomic<boost::uint32_t> sequence;
+    boost::uint32_t stamp_sec;
+    boost::uint32_t stamp_nsec;
+    boost::uint32_t num_readings;
+    float angle_min;
+    float angle_increment;
+    float time_increment;
+    float scan_time;
+    float range_min;
+    float range_max;
+    char frame_id[FRAME_ID_SIZE];
+};
+
+//! Slots start at multiples of 64 bytes, so two slots never share a cache line
+size_t slotSize(boost::uint32_t max_readings) {
+    size_t size = sizeof(SlotHeader) + max_readings * sizeof(float);
+    return (size + 63) / 64 * 64;
+}
+
+size_t headerSize() {
+    return (sizeof(RingHeader) + 63) / 64 * 64;
+}
+
+SlotHeader* slot(char* memory, boost::uint64_t index) {
+    RingHeader* header = reinterpret_cast<RingHeader*>(memory);
+    return reinterpret_cast<SlotHeader*>(memory + headerSize() + (index % header->num_slots) * slotSize(header->max_readings));
+}
+
+float* slotRanges(SlotHeader* slot) {
+    return reinterpret_cast<float*>(slot + 1);
+}
+
+//! The ring is shared between processes, so its atomics must not fall back to a process-local lock
+bool atomicsLockFree() {
+    boost::atomic<boost::uint32_t> a32(0);
+    boost::atomic<boost::uint64_t> a64(0);
+    return a32.is_lock_free() && a64.is_lock_free();
+}
+
+}
+
+ScanRingWriter::ScanRingWriter() : memory_(0), size_(0) {
+}
+
+ScanRingWriter::~ScanRingWriter() {
+    close();
+}
+
+bool ScanRingWriter::create(const std::string& name, int num_slots, int max_readings) {
+
+    close();
+    if (num_slots < 2 || max_readings < 1) {
+        ROS_ERROR("Scan ring %s needs at least 2 slots and 1 reading", name.c_str());
+        return false;
+    }
+    if (!atomicsLockFree()) {
+        ROS_ERROR("Scan ring %s: no lock-free atomics on this platform", name.c_str());
+        return false;
+    }
+
+    //! A new segment instead of resizing an existing one: readers of the old ring keep a valid mapping
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd < 0) {
+        ROS_ERROR("Cannot create scan ring %s: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+    size_t size = headerSize() + num_slots * slotSize(max_readings);
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        ROS_ERROR("Cannot map scan ring %s: %s", name.c_str(), strerror(errno));
+        shm_unlink(name.c_str());
+        return false;
+    }
+    name_ = name;
+    memory_ = static_cast<char*>(memory);
+    size_ = size;
+
+    RingHeader* header = new (memory_) RingHeader;
+    header->version = RING_VERSION;
+    header->num_slots = num_slots;
+    header->max_readings = max_readings;
+    header->num_written.store(0);
+    for (int i = 0; i < num_slots; ++i) {
+        new (slot(memory_, i)) SlotHeader;
+        slot(memory_, i)->sequence.store(0);
+    }
+    header->magic.store(RING_MAGIC, boost::memory_order_release);
+
+    ROS_INFO("Created scan ring %s: %d slots of %d readings", name.c_str(), num_slots, max_readings);
+    return true;
+}
+
+void ScanRingWriter::close() {
+    if (!memory_) return;
+    munmap(memory_, size_);
+    shm_unlink(name_.c_str());
+    memory_ = 0;
+}
+
+bool ScanRingWriter::write(const sensor_msgs::LaserScan& scan) {
+    return write(scan.header, scan.angle_min, scan.angle_increment, scan.time_increment, scan.scan_time, scan.range_min,
+                 scan.range_max, scan.ranges.empty() ? 0 : &scan.ranges[0], scan.ranges.size());
+}
+
+bool ScanRingWriter::write(const std_msgs::Header& header, float angle_min, float angle_increment, float time_increment,
+                           float scan_time, float range_min, float range_max, const float* ranges, int num_readings) {
+
+    if (!memory_) return false;
+    RingHeader* ring = reinterpret_cast<RingHeader*>(memory_);
+    if (num_readings > (int)ring->max_readings) {
+        ROS_ERROR_THROTTLE(1.0, "Scan of %d readings does not fit in scan ring %s of %d readings", num_readings,
+                           name_.c_str(), ring->max_readings);
+        return false;
+    }
+
+    //! Odd sequence while the slot is written; the fence keeps the data writes after it
+    boost::uint64_t index = ring->num_written.load(boost::memory_order_relaxed);
+    SlotHeader* s = slot(memory_, index);
+    s->sequence.fetch_add(1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    s->stamp_sec = header.stamp.sec;
+    s->stamp_nsec = header.stamp.nsec;
+    s->num_readings = num_readings;
+    s->angle_min = angle_min;
+    s->angle_increment = angle_increment;
+    s->time_increment = time_increment;
+    s->scan_time = scan_time;
+    s->range_min = range_min;
+    s->range_max = range_max;
+    strncpy(s->frame_id, header.frame_id.c_str(), FRAME_ID_SIZE - 1);
+    s->frame_id[FRAME_ID_SIZE - 1] = 0;
+    memcpy(slotRanges(s), ranges, num_readings * sizeof(float));
+
+    s->sequence.fetch_add(1, boost::memory_order_release);
+    ring->num_written.store(index + 1, boost::memory_order_release);
+    return true;
+}
+
+boost::uint64_t ScanRingWriter::numWritten() const {
+    return memory_ ? reinterpret_cast<RingHeader*>(memory_)->num_written.load(boost::memory_order_acquire) : 0;
+}
+
+ScanRingReader::ScanRingReader() : memory_(0), size_(0), num_read_(0), num_skipped_(0) {
+}
+
+ScanRingReader::~ScanRingReader() {
+    close();
+}
+
+bool ScanRingReader::open(const std::string& name) {
+
+    close();
+    if (!atomicsLockFree()) return false;
+
+    //! Mapped writable only because some platforms implement atomic loads with a compare-and-swap
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) return false;
+
+    //! The size of the segment bounds the ring described by its header
+    struct stat st;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= headerSize()) {
+        memory = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) return false;
+
+    const RingHeader* header = static_cast<const RingHeader*>(memory);
+    if (header->magic.load(boost::memory_order_acquire) != RING_MAGIC || header->version != RING_VERSION || header->num_slots < 2 ||
+        (size_t)st.st_size < headerSize() + header->num_slots * slotSize(header->max_readings)) {
+        munmap(memory, st.st_size);
+        return false;
+    }
+    memory_ = static_cast<char*>(memory);
+    size_ = st.st_size;
+
+    //! Only scans written from now on are new
+    num_read_ = header->num_written.load(boost::memory_order_acquire);
+    return true;
+}
+
+void ScanRingReader::close() {
+    if (!memory_) return;
+    munmap(memory_, size_);
+    memory_ = 0;
+}
+
+sensor_msgs::LaserScan::Ptr ScanRingReader::readLatest() {
+
+    sensor_msgs::LaserScan::Ptr scan;
+    if (!memory_) return scan;
+    RingHeader* ring = reinterpret_cast<RingHeader*>(memory_);
+
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+        boost::uint64_t num_written = ring->num_written.load(boost::memory_order_acquire);
+        if (num_written == num_read_) return sensor_msgs::LaserScan::Ptr();
+
+        //! Copy the slot, then check that the writer did not touch it meanwhile
+        SlotHeader* s = slot(memory_, num_written - 1);
+        boost::uint32_t sequence = s->sequence.load(boost::memory_order_acquire);
+        if (sequence & 1) continue;
+        if (!scan) scan.reset(new sensor_msgs::LaserScan);
+        boost::uint32_t num_readings = std::min(s->num_readings, ring->max_readings);
+        scan->header.stamp = ros::Time(s->stamp_sec, s->stamp_nsec);
+        scan->header.frame_id.assign(s->frame_id, strnlen(s->frame_id, FRAME_ID_SIZE));
+        scan->angle_min = s->angle_min;
+        scan->angle_increment = s->angle_increment;
+        scan->angle_max = s->angle_min + ((int)num_readings - 1) * s->angle_increment;
+        scan->time_increment = s->time_increment;
+        scan->scan_time = s->scan_time;
+        scan->range_min = s->range_min;
+        scan->range_max = s->range_max;
+        scan->ranges.resize(num_readings);
+        if (num_readings > 0) memcpy(&scan->ranges[0], slotRanges(s), num_readings * sizeof(float));
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (s->sequence.load(boost::memory_order_relaxed) != sequence) continue;
+
+        num_skipped_ += num_written - num_read_ - 1;
+        num_read_ = num_written;
+        return scan;
+    }
+
+    //! The writer laps this reader; try again at the next poll
+    return sensor_msgs::LaserScan::Ptr();
+}
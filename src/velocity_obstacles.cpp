@@ -0,0 +1,229 @@
+/*
+ * Parts of this file (addObstacle and linearProgram1/2/3) are adapted from
+ * Agent.cpp of the RVO2 Library:
+ *
+ * Copyright 2008 University of North Carolina at Chapel Hill
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * <http://gamma.cs.unc.edu/RVO2/>
+ *
+ * Modifications: single robot without neighbour agents, obstacles passed in
+ * per cycle, responsibility per obstacle, guard for a relative velocity at
+ * the cutoff center.
+ */
+#include "tue_carrot_planner/velocity_obstacles.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+typedef VelocityObstacles::Vector2 Vector2;
+
+const double EPSILON = 1e-5;
+
+inline Vector2 operator+(const Vector2& a, const Vector2& b) { return Vector2(a.x + b.x, a.y + b.y); }
+inline Vector2 operator-(const Vector2& a, const Vector2& b) { return Vector2(a.x - b.x, a.y - b.y); }
+inline Vector2 operator-(const Vector2& a) { return Vector2(-a.x, -a.y); }
+inline Vector2 operator*(double s, const Vector2& a) { return Vector2(s * a.x, s * a.y); }
+inline double dot(const Vector2& a, const Vector2& b) { return a.x * b.x + a.y * b.y; }
+inline double det(const Vector2& a, const Vector2& b) { return a.x * b.y - a.y * b.x; }
+inline double absSq(const Vector2& a) { return dot(a, a); }
+inline Vector2 normalize(const Vector2& a) { return (1.0 / sqrt(absSq(a))) * a; }
+
+}
+
+VelocityObstacles::VelocityObstacles(double time_horizon) : time_horizon_(time_horizon), radius_(0), dt_(0.1) {
+}
+
+void VelocityObstacles::reset(double radius, const Vector2& velocity, double dt) {
+    radius_ = radius;
+    velocity_ = velocity;
+    dt_ = (dt > 0) ? dt : 0.1;
+    lines_.clear();
+}
+
+void VelocityObstacles::addObstacle(const Vector2& position, const Vector2& velocity, double radius, double responsibility) {
+
+    const Vector2 rel_velocity = velocity_ - velocity;
+    const double dist_sq = absSq(position);
+    const double combined_radius = radius_ + radius;
+    const double combined_radius_sq = combined_radius * combined_radius;
+
+    Line line;
+    Vector2 u;
+
+    if (dist_sq > combined_radius_sq) {
+        //! No collision: vector from cutoff center to relative velocity
+        const Vector2 w = rel_velocity - (1.0 / time_horizon_) * position;
+        const double w_length_sq = absSq(w);
+        const double dot_product1 = dot(w, position);
+
+        if (dot_product1 < 0 && dot_product1 * dot_product1 > combined_radius_sq * w_length_sq) {
+            //! Project on cut-off circle
+            const double w_length = sqrt(w_length_sq);
+            const Vector2 unit_w = (1.0 / w_length) * w;
+            line.direction = Vector2(unit_w.y, -unit_w.x);
+            u = (combined_radius / time_horizon_ - w_length) * unit_w;
+        } else {
+            //! Project on legs
+            const double leg = sqrt(dist_sq - combined_radius_sq);
+            if (det(position, w) > 0) {
+                line.direction = (1.0 / dist_sq) * Vector2(position.x * leg - position.y * combined_radius,
+                                                           position.x * combined_radius + position.y * leg);
+            } else {
+                line.direction = -((1.0 / dist_sq) * Vector2(position.x * leg + position.y * combined_radius,
+                                                             -position.x * combined_radius + position.y * leg));
+            }
+            const double dot_product2 = dot(rel_velocity, line.direction);
+            u = dot_product2 * line.direction - rel_velocity;
+        }
+    } else {
+        //! Collision: project on cut-off circle of one time step
+        const Vector2 w = rel_velocity - (1.0 / dt_) * position;
+        const double w_length = sqrt(absSq(w));
+
+        //! Relative velocity exactly at the cutoff center: push straight away from the obstacle
+        Vector2 unit_w;
+        if (w_length > EPSILON) {
+            unit_w = (1.0 / w_length) * w;
+        } else if (dist_sq > EPSILON * EPSILON) {
+            unit_w = -normalize(position);
+        } else {
+            unit_w = Vector2(-1, 0);
+        }
+        line.direction = Vector2(unit_w.y, -unit_w.x);
+        u = (combined_radius / dt_ - w_length) * unit_w;
+    }
+
+    line.point = velocity_ + responsibility * u;
+    lines_.push_back(line);
+}
+
+bool VelocityObstacles::solve(const Vector2& preferred, double max_speed, Vector2& result) const {
+
+    size_t line_fail = linearProgram2(lines_, max_speed, preferred, false, result);
+    if (line_fail < lines_.size()) {
+        linearProgram3(lines_, line_fail, max_speed, result);
+        return false;
+    }
+    return true;
+}
+
+bool VelocityObstacles::linearProgram1(const std::vector<Line>& lines, size_t line_no, double radius, const Vector2& opt_velocity,
+                                       bool direction_opt, Vector2& result) const {
+
+    const double dot_product = dot(lines[line_no].point, lines[line_no].direction);
+    const double discriminant = dot_product * dot_product + radius * radius - absSq(lines[line_no].point);
+
+    //! Max speed circle fully invalidates line
+    if (discriminant < 0) return false;
+
+    const double sqrt_discriminant = sqrt(discriminant);
+    double t_left = -dot_product - sqrt_discriminant;
+    double t_right = -dot_product + sqrt_discriminant;
+
+    for (size_t i = 0; i < line_no; ++i) {
+        const double denominator = det(lines[line_no].direction, lines[i].direction);
+        const double numerator = det(lines[i].direction, lines[line_no].point - lines[i].point);
+
+        if (fabs(denominator) <= EPSILON) {
+            //! Lines are (almost) parallel
+            if (numerator < 0) return false;
+            continue;
+        }
+
+        const double t = numerator / denominator;
+        if (denominator >= 0) {
+            t_right = std::min(t_right, t);
+        } else {
+            t_left = std::max(t_left, t);
+        }
+        if (t_left > t_right) return false;
+    }
+
+    if (direction_opt) {
+        //! Optimize direction
+        if (dot(opt_velocity, lines[line_no].direction) > 0) {
+            result = lines[line_no].point + t_right * lines[line_no].direction;
+        } else {
+            result = lines[line_no].point + t_left * lines[line_no].direction;
+        }
+    } else {
+        //! Optimize closest point
+        const double t = dot(lines[line_no].direction, opt_velocity - lines[line_no].point);
+        result = lines[line_no].point + std::max(t_left, std::min(t_right, t)) * lines[line_no].direction;
+    }
+
+    return true;
+}
+
+size_t VelocityObstacles::linearProgram2(const std::vector<Line>& lines, double radius, const Vector2& opt_velocity,
+                                         bool direction_opt, Vector2& result) const {
+
+    if (direction_opt) {
+        result = radius * opt_velocity;
+    } else if (absSq(opt_velocity) > radius * radius) {
+        result = radius * normalize(opt_velocity);
+    } else {
+        result = opt_velocity;
+    }
+
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (det(lines[i].direction, lines[i].point - result) > 0) {
+            //! Result does not satisfy constraint i, compute new optimal result
+            const Vector2 temp_result = result;
+            if (!linearProgram1(lines, i, radius, opt_velocity, direction_opt, result)) {
+                result = temp_result;
+                return i;
+            }
+        }
+    }
+
+    return lines.size();
+}
+
+void VelocityObstacles::linearProgram3(const std::vector<Line>& lines, size_t begin_line, double radius, Vector2& result) const {
+
+    //! Infeasible: minimize the maximum violation of the constraints
+    double distance = 0;
+
+    for (size_t i = begin_line; i < lines.size(); ++i) {
+        if (det(lines[i].direction, lines[i].point - result) > distance) {
+            std::vector<Line> proj_lines;
+            for (size_t j = 0; j < i; ++j) {
+                Line line;
+                const double determinant = det(lines[i].direction, lines[j].direction);
+
+                if (fabs(determinant) <= EPSILON) {
+                    //! Line i and line j are parallel
+                    if (dot(lines[i].direction, lines[j].direction) > 0) continue;
+                    line.point = 0.5 * (lines[i].point + lines[j].point);
+                } else {
+                    line.point = lines[i].point + (det(lines[j].direction, lines[i].point - lines[j].point) / determinant) * lines[i].direction;
+                }
+
+                line.direction = normalize(lines[j].direction - lines[i].direction);
+                proj_lines.push_back(line);
+            }
+
+            const Vector2 temp_result = result;
+            if (linearProgram2(proj_lines, radius, Vector2(-lines[i].direction.y, lines[i].direction.x), true, result) < proj_lines.size()) {
+                //! Can only happen due to floating point errors, keep the previous result
+                result = temp_result;
+            }
+
+            distance = det(lines[i].direction, lines[i].point - result);
+        }
+    }
+}
@@ -0,0 +1,682 @@
+#include <gtest/gtest.h>
+#include <ros/ros.h>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+
+#include "tue_carrot_planner/carrot_planner.h"
+#include "tue_carrot_planner/distance_transform.h"
+#include "tue_carrot_planner/velocity_obstacles.h"
+#include "tue_carrot_planner/scan_ring.h"
+#include "tue_carrot_planner/scan_dataset.h"
+
+//! Golden trajectories are recorded in FIXTURE_DIR. Set CARROT_PLANNER_RECORD_FIXTURES=1 to record them again after an
+//! intended change of behaviour, and review the difference of the fixtures like any other change.
+
+namespace {
+
+//! Scanner geometry of the test scans
+const int NUM_READINGS = 1001;
+const float ANGLE_MIN = -2.0;
+const float ANGLE_INCREMENT = 0.004;
+const float RANGE_MAX = 10.0;
+const double CYCLE_TIME = 0.1;
+const double T_START = 1000.0;
+
+//! The goal is reached once the robot is this close to it; smaller angles without translation are ignored by the
+//! planner (min_angle_zero_trans)
+const double GOAL_TOLERANCE = 0.05;
+const double GOAL_ANGLE_TOLERANCE = 10.0 / 180.0 * M_PI;
+
+sensor_msgs::LaserScan makeScan(float range) {
+    sensor_msgs::LaserScan scan;
+    scan.header.frame_id = "/amigo/base_laser";
+    scan.angle_min = ANGLE_MIN;
+    scan.angle_increment = ANGLE_INCREMENT;
+    scan.angle_max = ANGLE_MIN + (NUM_READINGS - 1) * ANGLE_INCREMENT;
+    scan.scan_time = CYCLE_TIME;
+    scan.range_min = 0.05;
+    scan.range_max = RANGE_MAX;
+    scan.ranges.assign(NUM_READINGS, range);
+    return scan;
+}
+
+//! Wall segment in the world
+struct Segment {
+    double x1, y1, x2, y2;
+    Segment(double x1_, double y1_, double x2_, double y2_) : x1(x1_), y1(y1_), x2(x2_), y2(y2_) {}
+};
+
+//! Scan of a world of wall segments, seen from pose (x, y, th)
+sensor_msgs::LaserScan::ConstPtr simulateScan(double x, double y, double th, const std::vector<Segment>& segments, const ros::Time& stamp) {
+    sensor_msgs::LaserScan::Ptr scan(new sensor_msgs::LaserScan(makeScan(RANGE_MAX)));
+    scan->header.stamp = stamp;
+    for (int j = 0; j < NUM_READINGS; ++j) {
+        double dx = cos(th + ANGLE_MIN + j * ANGLE_INCREMENT), dy = sin(th + ANGLE_MIN + j * ANGLE_INCREMENT);
+        double range = RANGE_MAX;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            //! Intersection of the beam (x, y) + r (dx, dy) with the segment p1 + u (p2 - p1)
+            double sx = segments[i].x2 - segments[i].x1, sy = segments[i].y2 - segments[i].y1;
+            double det = sx * dy - sy * dx;
+            if (fabs(det) < 1e-12) continue;
+            double px = segments[i].x1 - x, py = segments[i].y1 - y;
+            double r = (sx * py - sy * px) / det;
+            double u = (dx * py - dy * px) / det;
+            if (r > 0 && u >= 0 && u <= 1) range = std::min(range, r);
+        }
+        scan->ranges[j] = range;
+    }
+    return scan;
+}
+
+//! Command of a cycle, with the pose of the robot at that cycle
+struct Sample {
+    double t, vx, vy, wz;
+    int moving;
+    double x, y, th;
+};
+
+//! Golden trajectory fixture: parameters, a goal in the world, the recorded time to reach the goal (-1 if it is not
+//! reached) and the recorded commands of every cycle
+struct Fixture {
+    std::vector<std::string> param_lines;
+    double goal_x, goal_y, goal_yaw;
+    std::vector<Segment> segments;
+    int cycles;
+    double time_to_goal;
+    std::vector<Sample> samples;
+    Fixture() : goal_x(0), goal_y(0), goal_yaw(0), cycles(0), time_to_goal(-1) {}
+};
+
+bool readFixture(const std::string& filename, Fixture& fixture) {
+
+    std::ifstream file(filename.c_str());
+    if (!file.is_open()) return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream in(line);
+        std::string key;
+        in >> key;
+        if (key == "param") fixture.param_lines.push_back(line);
+        else if (key == "goal") in >> fixture.goal_x >> fixture.goal_y >> fixture.goal_yaw;
+        else if (key == "wall") {
+            //! Wall across the whole world at x
+            double x;
+            in >> x;
+            fixture.segments.push_back(Segment(x, -100, x, 100));
+        } else if (key == "segment") {
+            double x1, y1, x2, y2;
+            in >> x1 >> y1 >> x2 >> y2;
+            fixture.segments.push_back(Segment(x1, y1, x2, y2));
+        }
+        else if (key == "cycles") in >> fixture.cycles;
+        else if (key == "time_to_goal") in >> fixture.time_to_goal;
+        else {
+            Sample sample;
+            std::istringstream values(line);
+            values >> sample.t >> sample.vx >> sample.vy >> sample.wz >> sample.moving;
+            fixture.samples.push_back(sample);
+        }
+    }
+    return true;
+}
+
+bool writeFixture(const std::string& filename, const Fixture& fixture) {
+
+    //! Keep everything but the recorded samples
+    std::ifstream in(filename.c_str());
+    std::ostringstream header;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#' || line.compare(0, 5, "param") == 0 || line.compare(0, 4, "goal") == 0 ||
+                line.compare(0, 4, "wall") == 0 || line.compare(0, 7, "segment") == 0 || line.compare(0, 6, "cycles") == 0) {
+            header << line << "\n";
+        }
+    }
+    in.close();
+
+    std::ofstream file(filename.c_str());
+    if (!file.is_open()) return false;
+    file << header.str();
+    file << std::fixed << std::setprecision(1) << "time_to_goal " << fixture.time_to_goal << "\n";
+    file << std::setprecision(9);
+    for (size_t i = 0; i < fixture.samples.size(); ++i) {
+        const Sample& s = fixture.samples[i];
+        file << std::setprecision(1) << s.t << std::setprecision(9) << " " << s.vx << " " << s.vy << " " << s.wz << " " << s.moving << "\n";
+    }
+    return true;
+}
+
+void setParams(const std::string& name, const std::vector<std::string>& param_lines) {
+
+    ros::NodeHandle nh("~");
+    nh.setParam(name + "/simulation", true);
+    for (size_t i = 0; i < param_lines.size(); ++i) {
+        std::istringstream in(param_lines[i]);
+        std::string key, param, type;
+        in >> key >> param >> type;
+        if (type == "double") {
+            double value;
+            in >> value;
+            nh.setParam(name + "/" + param, value);
+        } else if (type == "int") {
+            int value;
+            in >> value;
+            nh.setParam(name + "/" + param, value);
+        } else if (type == "bool") {
+            std::string value;
+            in >> value;
+            nh.setParam(name + "/" + param, value == "true");
+        }
+    }
+}
+
+//! Drive a planner in closed loop with an ideal base: the pose integrates the published commands. Returns the time
+//! until the goal is reached, -1 if it is not reached within the cycles of the fixture.
+double runTrajectory(const std::string& name, const Fixture& fixture, std::vector<Sample>& samples) {
+
+    setParams(name, fixture.param_lines);
+    CarrotPlanner planner(name);
+
+    double x = 0, y = 0, th = 0;
+    double time_to_goal = -1;
+    for (int k = 0; k < fixture.cycles; ++k) {
+        ros::Time now(T_START + k * CYCLE_TIME);
+        planner.setLaserScan(simulateScan(x, y, th, fixture.segments, now));
+
+        //! Goal in the robot frame
+        double dx = fixture.goal_x - x, dy = fixture.goal_y - y;
+        double angle_error = atan2(sin(fixture.goal_yaw - th), cos(fixture.goal_yaw - th));
+        if (time_to_goal < 0 && sqrt(dx * dx + dy * dy) < GOAL_TOLERANCE && fabs(angle_error) < GOAL_ANGLE_TOLERANCE) {
+            time_to_goal = k * CYCLE_TIME;
+        }
+        geometry_msgs::PoseStamped goal;
+        goal.header.frame_id = "/amigo/base_link";
+        goal.pose.position.x = cos(th) * dx + sin(th) * dy;
+        goal.pose.position.y = -sin(th) * dx + cos(th) * dy;
+        goal.pose.orientation = tf::createQuaternionMsgFromYaw(angle_error);
+
+        Sample sample;
+        sample.t = now.toSec();
+        sample.moving = planner.MoveToGoal(goal, now);
+        geometry_msgs::Twist cmd_vel = planner.getPublishedCommand();
+        sample.vx = cmd_vel.linear.x;
+        sample.vy = cmd_vel.linear.y;
+        sample.wz = cmd_vel.angular.z;
+        sample.x = x;
+        sample.y = y;
+        sample.th = th;
+        samples.push_back(sample);
+
+        x += (cos(th) * cmd_vel.linear.x - sin(th) * cmd_vel.linear.y) * CYCLE_TIME;
+        y += (sin(th) * cmd_vel.linear.x + cos(th) * cmd_vel.linear.y) * CYCLE_TIME;
+        th += cmd_vel.angular.z * CYCLE_TIME;
+    }
+
+    return time_to_goal;
+}
+
+void checkGoldenTrajectory(const std::string& name) {
+
+    std::string filename = std::string(FIXTURE_DIR) + "/" + name + ".txt";
+    Fixture fixture;
+    ASSERT_TRUE(readFixture(filename, fixture)) << "Cannot read " << filename;
+
+    std::vector<Sample> samples;
+    double time_to_goal = runTrajectory(name, fixture, samples);
+
+    //! Report the change of the time to reach the goal, the figure of merit of tuning changes
+    std::cout << "[ GOLDEN   ] " << name << ": time to goal " << time_to_goal << " [s], recorded " << fixture.time_to_goal << " [s]";
+    if (time_to_goal >= 0 && fixture.time_to_goal >= 0) {
+        std::cout << ", delta " << time_to_goal - fixture.time_to_goal << " [s]";
+        testing::Test::RecordProperty("time_to_goal_delta", testing::PrintToString(time_to_goal - fixture.time_to_goal));
+    }
+    std::cout << std::endl;
+    testing::Test::RecordProperty("time_to_goal", testing::PrintToString(time_to_goal));
+
+    if (getenv("CARROT_PLANNER_RECORD_FIXTURES")) {
+        fixture.time_to_goal = time_to_goal;
+        fixture.samples = samples;
+        ASSERT_TRUE(writeFixture(filename, fixture)) << "Cannot write " << filename;
+        return;
+    }
+
+    EXPECT_NEAR(fixture.time_to_goal, time_to_goal, 1e-6) << name << ": time to goal changed";
+    ASSERT_EQ(fixture.samples.size(), samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        EXPECT_NEAR(fixture.samples[i].vx, samples[i].vx, 1e-6) << name << ", cycle " << i;
+        EXPECT_NEAR(fixture.samples[i].vy, samples[i].vy, 1e-6) << name << ", cycle " << i;
+        EXPECT_NEAR(fixture.samples[i].wz, samples[i].wz, 1e-6) << name << ", cycle " << i;
+        EXPECT_EQ(fixture.samples[i].moving, samples[i].moving) << name << ", cycle " << i;
+    }
+}
+
+}
+
+//! Golden trajectories of the complete planner
+
+TEST(GoldenTrajectory, Straight) {
+    checkGoldenTrajectory("straight");
+}
+
+TEST(GoldenTrajectory, Turn) {
+    checkGoldenTrajectory("turn");
+}
+
+TEST(GoldenTrajectory, RotateInPlace) {
+    checkGoldenTrajectory("rotate_in_place");
+}
+
+TEST(GoldenTrajectory, ZeroAngle) {
+    checkGoldenTrajectory("zero_angle");
+}
+
+TEST(GoldenTrajectory, SmallAngle) {
+    checkGoldenTrajectory("small_angle");
+}
+
+TEST(GoldenTrajectory, BlockedByWall) {
+    checkGoldenTrajectory("blocked_by_wall");
+}
+
+TEST(GoldenTrajectory, LateralAccelerationLimit) {
+    checkGoldenTrajectory("lateral_acceleration");
+}
+
+TEST(GoldenTrajectory, Repeatable) {
+
+    //! The same inputs give the same commands, also in a second planner instance
+    Fixture fixture;
+    fixture.goal_x = 1.5;
+    fixture.goal_y = 0.5;
+    fixture.goal_yaw = 0.3;
+    fixture.cycles = 30;
+    std::vector<Sample> first, second;
+    runTrajectory("repeatable_1", fixture, first);
+    runTrajectory("repeatable_2", fixture, second);
+    ASSERT_EQ(first.size(), second.size());
+    for (size_t i = 0; i < first.size(); ++i) {
+        EXPECT_EQ(first[i].vx, second[i].vx);
+        EXPECT_EQ(first[i].vy, second[i].vy);
+        EXPECT_EQ(first[i].wz, second[i].wz);
+    }
+}
+
+//! Lateral position of the robot where it crosses x = x_cross, NaN if it does not get there
+double lateralPositionAt(const std::vector<Sample>& samples, double x_cross) {
+    for (size_t i = 1; i < samples.size(); ++i) {
+        if (samples[i - 1].x < x_cross && samples[i].x >= x_cross) {
+            double f = (x_cross - samples[i - 1].x) / (samples[i].x - samples[i - 1].x);
+            return samples[i - 1].y + f * (samples[i].y - samples[i - 1].y);
+        }
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+//! Doorway centering
+
+TEST(DoorwayCentering, OffCentreDoorway) {
+    checkGoldenTrajectory("doorway_off_centre");
+
+    //! The door frame is 0.3 [m] from the straight path, closer than the robot radius: with centering the robot passes
+    //! the door nearer to its centre at y = 0.15. The door is only seen within the virtual wall distance, so the robot
+    //! does not reach the centre line before it passes the frame.
+    Fixture fixture;
+    ASSERT_TRUE(readFixture(std::string(FIXTURE_DIR) + "/doorway_off_centre.txt", fixture));
+    std::vector<Sample> centred, straight;
+    runTrajectory("doorway_centred", fixture, centred);
+    fixture.param_lines.clear();
+    runTrajectory("doorway_straight", fixture, straight);
+    double y_centred = lateralPositionAt(centred, 1.5);
+    double y_straight = lateralPositionAt(straight, 1.5);
+    ASSERT_FALSE(std::isnan(y_centred)) << "The robot does not pass the door with centering";
+    ASSERT_FALSE(std::isnan(y_straight)) << "The robot does not pass the door without centering";
+    EXPECT_LT(fabs(y_centred - 0.15), fabs(y_straight - 0.15));
+    EXPECT_GT(y_centred - y_straight, 0.03);
+}
+
+TEST(DoorwayCentering, SideDoorNotCentred) {
+
+    //! Corridor of 1.4 [m], 0.1 [m] right of the robot, with a door in the left wall: the goal behind the side door does
+    //! not lie through the passage ahead, so centering leaves the carrot alone
+    Fixture fixture;
+    fixture.goal_x = 1.2;
+    fixture.goal_y = 2.0;
+    fixture.cycles = 100;
+    fixture.segments.push_back(Segment(-1.0, -0.8, 4.0, -0.8));
+    fixture.segments.push_back(Segment(-1.0, 0.6, 0.7, 0.6));
+    fixture.segments.push_back(Segment(1.7, 0.6, 4.0, 0.6));
+    fixture.param_lines.push_back("param doorway_centering bool true");
+    std::vector<Sample> centred, plain;
+    runTrajectory("side_door_centred", fixture, centred);
+    fixture.param_lines.clear();
+    runTrajectory("side_door_plain", fixture, plain);
+    ASSERT_EQ(plain.size(), centred.size());
+    for (size_t i = 0; i < plain.size(); ++i) {
+        EXPECT_NEAR(plain[i].vx, centred[i].vx, 1e-6) << "cycle " << i;
+        EXPECT_NEAR(plain[i].vy, centred[i].vy, 1e-6) << "cycle " << i;
+        EXPECT_NEAR(plain[i].wz, centred[i].wz, 1e-6) << "cycle " << i;
+    }
+}
+
+//! Clear-line kernel
+
+TEST(ClearLine, FreeScan) {
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    EXPECT_TRUE(CarrotPlanner::isClearLine(scan, 0.0, 0.65, 0.5));
+}
+
+TEST(ClearLine, ObstacleInWedge) {
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    scan.ranges[NUM_READINGS / 2 + 10] = 0.4;
+    int beam = -1;
+    double distance = 0;
+    EXPECT_FALSE(CarrotPlanner::isClearLine(scan, 0.0, 0.65, 0.5, &beam, &distance));
+    EXPECT_EQ(NUM_READINGS / 2 + 10, beam);
+    EXPECT_FLOAT_EQ(0.4, distance);
+}
+
+TEST(ClearLine, ObstacleBeyondWall) {
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    scan.ranges[NUM_READINGS / 2] = 0.7;
+    EXPECT_TRUE(CarrotPlanner::isClearLine(scan, 0.0, 0.65, 0.5));
+}
+
+TEST(ClearLine, ObstacleOutsideWedge) {
+    //! atan2(0.5, 0.65) is about 0.66 rad, an obstacle at 1.2 rad is outside the wedge
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    scan.ranges[NUM_READINGS / 2 + 300] = 0.3;
+    EXPECT_TRUE(CarrotPlanner::isClearLine(scan, 0.0, 0.65, 0.5));
+    EXPECT_FALSE(CarrotPlanner::isClearLine(scan, 1.2, 0.65, 0.5));
+}
+
+TEST(ClearLine, InvalidRangesIgnored) {
+    sensor_msgs::LaserScan scan = makeScan(0.0);
+    EXPECT_TRUE(CarrotPlanner::isClearLine(scan, 0.0, 0.65, 0.5));
+}
+
+TEST(ClearLine, BatchMatchesSingle) {
+    const int num_scans = 4;
+    std::vector<float> ranges(num_scans * NUM_READINGS, RANGE_MAX);
+    ranges[1 * NUM_READINGS + NUM_READINGS / 2] = 0.3;
+    ranges[3 * NUM_READINGS + NUM_READINGS / 2 + 250] = 0.3;
+    double angle_goals[num_scans] = {0.0, 0.0, 0.0, 1.0};
+    bool path_free[num_scans];
+    CarrotPlanner::isClearLine(&ranges[0], num_scans, NUM_READINGS, ANGLE_MIN, ANGLE_INCREMENT, angle_goals, 0.65, 0.5, path_free);
+    for (int i = 0; i < num_scans; ++i) {
+        EXPECT_EQ(CarrotPlanner::isClearLine(&ranges[i * NUM_READINGS], NUM_READINGS, ANGLE_MIN, ANGLE_INCREMENT, angle_goals[i], 0.65, 0.5),
+                  path_free[i]) << "scan " << i;
+    }
+    EXPECT_TRUE(path_free[0]);
+    EXPECT_FALSE(path_free[1]);
+    EXPECT_FALSE(path_free[3]);
+}
+
+TEST(ClearLine, ThreadedBatchMatchesSerial) {
+    const int num_scans = 101;
+    std::vector<float> ranges(num_scans * NUM_READINGS, RANGE_MAX);
+    std::vector<double> angle_goals(num_scans);
+    for (int i = 0; i < num_scans; ++i) {
+        ranges[i * NUM_READINGS + (i * 37) % NUM_READINGS] = 0.3;
+        angle_goals[i] = -1.0 + 0.02 * i;
+    }
+    bool serial[num_scans], threaded[num_scans];
+    CarrotPlanner::isClearLine(&ranges[0], num_scans, NUM_READINGS, ANGLE_MIN, ANGLE_INCREMENT, &angle_goals[0], 0.65, 0.5, serial);
+    CarrotPlanner::isClearLine(&ranges[0], num_scans, NUM_READINGS, ANGLE_MIN, ANGLE_INCREMENT, &angle_goals[0], 0.65, 0.5, threaded, 4);
+    int num_blocked = 0;
+    for (int i = 0; i < num_scans; ++i) {
+        EXPECT_EQ(serial[i], threaded[i]) << "scan " << i;
+        num_blocked += !serial[i];
+    }
+    EXPECT_GT(num_blocked, 0);
+    EXPECT_LT(num_blocked, num_scans);
+}
+
+//! Distance transform
+
+namespace {
+
+float bruteForceDistance(const std::vector<bool>& occupied, int width, int height, int x, int y) {
+    float best = std::numeric_limits<float>::infinity();
+    for (int v = 0; v < height; ++v) {
+        for (int u = 0; u < width; ++u) {
+            if (occupied[v * width + u]) best = std::min(best, (float)sqrt((double)(u - x) * (u - x) + (v - y) * (v - y)));
+        }
+    }
+    return best;
+}
+
+void expectBruteForce(const DistanceTransform& dt, const std::vector<bool>& occupied, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            EXPECT_NEAR(bruteForceDistance(occupied, width, height, x, y), dt.distance(x, y), 1e-4) << "cell " << x << ", " << y;
+        }
+    }
+}
+
+}
+
+TEST(DistanceTransform, SingleCell) {
+    std::vector<bool> occupied(5 * 4, false);
+    occupied[2 * 5 + 1] = true;
+    DistanceTransform dt;
+    dt.update(occupied, 5, 4);
+    EXPECT_EQ(5, dt.width());
+    EXPECT_EQ(4, dt.height());
+    EXPECT_FLOAT_EQ(0, dt.distance(1, 2));
+    EXPECT_FLOAT_EQ(1, dt.distance(1, 1));
+    EXPECT_NEAR(sqrt(13.0), dt.distance(4, 0), 1e-5);
+}
+
+TEST(DistanceTransform, MatchesBruteForce) {
+    const int width = 23, height = 17;
+    std::vector<bool> occupied(width * height, false);
+    unsigned int seed = 1;
+    for (size_t i = 0; i < occupied.size(); ++i) {
+        seed = seed * 1103515245 + 12345;
+        occupied[i] = ((seed >> 16) % 10) == 0;
+    }
+    DistanceTransform dt;
+    dt.update(occupied, width, height);
+    expectBruteForce(dt, occupied, width, height);
+}
+
+TEST(DistanceTransform, IncrementalUpdate) {
+    //! Only the changed columns are recomputed, the result must equal a full transform
+    const int width = 20, height = 12;
+    std::vector<bool> occupied(width * height, false);
+    occupied[3 * width + 4] = true;
+    occupied[8 * width + 15] = true;
+    DistanceTransform dt;
+    dt.update(occupied, width, height);
+    occupied[3 * width + 4] = false;
+    occupied[10 * width + 6] = true;
+    dt.update(occupied, width, height);
+    expectBruteForce(dt, occupied, width, height);
+}
+
+//! Velocity obstacles
+
+namespace {
+typedef VelocityObstacles::Vector2 Vector2;
+}
+
+TEST(VelocityObstacles, NoObstacles) {
+    VelocityObstacles vo(2.0);
+    vo.reset(0.5, Vector2(0.3, 0), 0.1);
+    Vector2 result;
+    EXPECT_TRUE(vo.solve(Vector2(0.5, 0.1), 0.75, result));
+    EXPECT_DOUBLE_EQ(0.5, result.x);
+    EXPECT_DOUBLE_EQ(0.1, result.y);
+}
+
+TEST(VelocityObstacles, MaxSpeed) {
+    VelocityObstacles vo(2.0);
+    vo.reset(0.5, Vector2(), 0.1);
+    Vector2 result;
+    EXPECT_TRUE(vo.solve(Vector2(2.0, 0), 0.75, result));
+    EXPECT_NEAR(0.75, result.x, 1e-9);
+    EXPECT_NEAR(0, result.y, 1e-9);
+}
+
+TEST(VelocityObstacles, HeadOnObstacle) {
+    //! Static obstacle 1.5 m ahead: driving straight at 0.75 m/s collides within the time horizon
+    VelocityObstacles vo(2.0);
+    vo.reset(0.5, Vector2(0.75, 0), 0.1);
+    vo.addObstacle(Vector2(1.5, 0), Vector2(), 0.2, 1.0);
+    Vector2 result;
+    EXPECT_TRUE(vo.solve(Vector2(0.75, 0), 0.75, result));
+    double speed = sqrt(result.x * result.x + result.y * result.y);
+    EXPECT_LE(speed, 0.75 + 1e-9);
+
+    //! Closest approach within the horizon stays outside the combined radius
+    double t = std::max(0.0, std::min(2.0, (1.5 * result.x) / std::max(1e-9, result.x * result.x + result.y * result.y)));
+    double dx = 1.5 - result.x * t, dy = -result.y * t;
+    EXPECT_GE(sqrt(dx * dx + dy * dy), 0.7 - 1e-6);
+}
+
+TEST(VelocityObstacles, RelativeVelocityAtCutoffCenter) {
+    //! Collision with the relative velocity exactly at the cutoff center must still give a finite velocity away from it
+    VelocityObstacles vo(2.0);
+    vo.reset(0.5, Vector2(3.0, 0), 0.1);
+    vo.addObstacle(Vector2(0.3, 0), Vector2(), 0.1, 1.0);
+    Vector2 result;
+    vo.solve(Vector2(0.5, 0), 0.75, result);
+    EXPECT_FALSE(std::isnan(result.x));
+    EXPECT_FALSE(std::isnan(result.y));
+    EXPECT_LT(result.x, 0);
+}
+
+//! Scan dataset
+
+TEST(ScanDataset, RoundTrip) {
+    std::string filename = testing::TempDir() + "scan_dataset_test.scans";
+    ScanDatasetWriter writer;
+    ASSERT_TRUE(writer.open(filename, NUM_READINGS));
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    for (int i = 0; i < 3; ++i) {
+        scan.header.stamp = ros::Time(T_START + i * CYCLE_TIME);
+        scan.angle_min = ANGLE_MIN + i;
+        scan.ranges[i] = 0.1 * (i + 1);
+        ASSERT_TRUE(writer.append(scan, 0.5 * i));
+    }
+    scan.ranges.resize(NUM_READINGS - 1);
+    EXPECT_FALSE(writer.append(scan));
+    ASSERT_TRUE(writer.close());
+
+    ScanDatasetReader reader;
+    ASSERT_TRUE(reader.open(filename));
+    ASSERT_EQ(3u, reader.numScans());
+    ASSERT_EQ(NUM_READINGS, reader.numReadings());
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_NEAR(T_START + i * CYCLE_TIME, reader.stamp(i), 1e-6);
+        EXPECT_FLOAT_EQ(0.5 * i, reader.angleGoal(i));
+        EXPECT_FLOAT_EQ(ANGLE_MIN + i, reader.angleMin(i));
+        EXPECT_FLOAT_EQ(ANGLE_INCREMENT, reader.angleIncrement(i));
+        EXPECT_FLOAT_EQ(RANGE_MAX, reader.rangeMax(i));
+        EXPECT_FLOAT_EQ(0.1 * (i + 1), reader.ranges(i)[i]);
+        EXPECT_FLOAT_EQ(RANGE_MAX, reader.ranges(i)[NUM_READINGS - 1]);
+    }
+    EXPECT_EQ(reader.ranges(1), reader.ranges() + NUM_READINGS);
+    reader.close();
+
+    //! A truncated file is rejected
+    ASSERT_EQ(0, truncate(filename.c_str(), 64 + NUM_READINGS * sizeof(float)));
+    EXPECT_FALSE(reader.open(filename));
+    unlink(filename.c_str());
+}
+
+//! Shared-memory scan ring
+
+namespace {
+std::string testRingName() {
+    std::ostringstream name;
+    name << "/tue_carrot_planner_test_" << getpid();
+    return name.str();
+}
+}
+
+TEST(ScanRing, RoundTrip) {
+    ScanRingWriter writer;
+    ASSERT_TRUE(writer.create(testRingName(), 4, NUM_READINGS));
+    ScanRingReader reader;
+    ASSERT_TRUE(reader.open(testRingName()));
+    EXPECT_FALSE(reader.readLatest());
+
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    scan.header.stamp = ros::Time(T_START);
+    for (int j = 0; j < NUM_READINGS; ++j) scan.ranges[j] = 0.5 + 0.001 * j;
+    ASSERT_TRUE(writer.write(scan));
+    sensor_msgs::LaserScan::Ptr read = reader.readLatest();
+    ASSERT_TRUE(read);
+    EXPECT_EQ(scan.header.frame_id, read->header.frame_id);
+    EXPECT_EQ(scan.header.stamp.sec, read->header.stamp.sec);
+    EXPECT_EQ(scan.header.stamp.nsec, read->header.stamp.nsec);
+    EXPECT_FLOAT_EQ(scan.angle_min, read->angle_min);
+    EXPECT_FLOAT_EQ(scan.angle_max, read->angle_max);
+    EXPECT_FLOAT_EQ(scan.angle_increment, read->angle_increment);
+    EXPECT_FLOAT_EQ(scan.range_max, read->range_max);
+    EXPECT_TRUE(scan.ranges == read->ranges);
+
+    //! A scan is read once
+    EXPECT_FALSE(reader.readLatest());
+
+    //! Too many readings for the ring
+    scan.ranges.resize(NUM_READINGS + 1);
+    EXPECT_FALSE(writer.write(scan));
+}
+
+TEST(ScanRing, ReaderGetsNewestScan) {
+    ScanRingWriter writer;
+    ASSERT_TRUE(writer.create(testRingName(), 4, NUM_READINGS));
+    ScanRingReader reader;
+    ASSERT_TRUE(reader.open(testRingName()));
+
+    //! More scans than slots: the reader skips to the newest and counts the others
+    sensor_msgs::LaserScan scan = makeScan(RANGE_MAX);
+    for (int i = 0; i < 10; ++i) {
+        scan.ranges[0] = i;
+        ASSERT_TRUE(writer.write(scan));
+    }
+    sensor_msgs::LaserScan::Ptr read = reader.readLatest();
+    ASSERT_TRUE(read);
+    EXPECT_FLOAT_EQ(9, read->ranges[0]);
+    EXPECT_EQ(9u, reader.numSkipped());
+    EXPECT_EQ(10u, writer.numWritten());
+}
+
+TEST(ScanRing, PlannerIngest) {
+
+    //! Scans written into the ring reach the planner without the topic
+    ScanRingWriter writer;
+    ASSERT_TRUE(writer.create(testRingName(), 4, NUM_READINGS));
+    ros::NodeHandle nh("~");
+    nh.setParam("scan_ring/simulation", true);
+    nh.setParam("scan_ring/scan_ring", testRingName());
+    CarrotPlanner planner("scan_ring");
+    EXPECT_EQ(std::numeric_limits<double>::infinity(), planner.getMinimumClearance());
+
+    sensor_msgs::LaserScan scan = makeScan(1.0);
+    scan.header.stamp = ros::Time(T_START);
+    double clearance = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < 200 && std::isinf(clearance); ++i) {
+        writer.write(scan);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+        clearance = planner.getMinimumClearance();
+    }
+    EXPECT_NEAR(0.5, clearance, 1e-6);
+}
+
+int main(int argc, char** argv) {
+    ros::init(argc, argv, "test_carrot_planner");
+    ros::NodeHandle nh;
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,477 @@
+//! Scenario fuzzer for the carrot planner: random obstacle layouts and goal sequences, run closed-loop in a kinematic
+//! simulation with one planner per thread, searching for oscillation, deadlock, collisions and an excessive time to
+//! reach the goals. Obstacles keep clear of the straight path between the goals, so a correct planner reaches every goal.
+//! Failing scenarios are shrunk by removing obstacles and goals while the failure persists, and saved as replayable
+//! scenario files.
+//!
+//!   carrot_planner_fuzz [--scenarios 1000] [--seed 1] [--threads 0] [--output-dir .] [--time-factor 3]
+//!                       [--param name=value ...]
+//!   carrot_planner_fuzz --replay scenario.txt [--trace]
+//!
+//! The planners advertise their topics, so a roscore must be running.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <ros/ros.h>
+#include "tue_carrot_planner/carrot_planner.h"
+
+namespace {
+
+//! Scanner geometry and control cycle of the simulation, the same as those of the golden trajectory tests
+const int NUM_READINGS = 1001;
+const float ANGLE_MIN = -2.0;
+const float ANGLE_INCREMENT = 0.004;
+const float RANGE_MAX = 10.0;
+const double CYCLE_TIME = 0.1;
+const double T_START = 1000.0;
+
+//! A goal is reached this close to it; smaller angles without translation are ignored by the planner
+const double GOAL_TOLERANCE = 0.05;
+const double GOAL_ANGLE_TOLERANCE = 10.0 / 180.0 * M_PI;
+
+//! Obstacles keep this much more than the robot radius from the straight path between the goals
+const double PATH_MARGIN = 0.1;
+
+//! Slack on top of the allowed time to reach the goals
+const double TIME_SLACK = 10.0;
+
+const int MAX_OBSTACLES = 12;
+const int MAX_GOALS = 3;
+
+struct Obstacle {
+    double x, y, radius;
+};
+
+struct Waypoint {
+    double x, y, yaw;
+};
+
+//! Everything needed to replay a run: the planner parameters, the world and the goals, in the world frame with the
+//! robot starting at the origin
+struct Scenario {
+    unsigned int seed;
+    std::vector<std::string> param_lines;
+    std::vector<Obstacle> obstacles;
+    std::vector<Waypoint> goals;
+    Scenario() : seed(0) {}
+};
+
+enum Outcome {
+    OUTCOME_OK,
+    OUTCOME_OSCILLATION,
+    OUTCOME_DEADLOCK,
+    OUTCOME_COLLISION,
+    OUTCOME_TIMEOUT
+};
+
+const char* outcomeName(Outcome outcome) {
+    const char* names[] = {"ok", "oscillation", "deadlock", "collision", "timeout"};
+    return names[outcome];
+}
+
+struct Result {
+    Outcome outcome;
+    double time;
+    int goals_reached;
+    Result() : outcome(OUTCOME_OK), time(0), goals_reached(0) {}
+};
+
+//! Value of a planner parameter of the scenario, or the planner's default
+double paramValue(const std::vector<std::string>& param_lines, const std::string& name, double default_value) {
+    for (size_t i = 0; i < param_lines.size(); ++i) {
+        std::istringstream in(param_lines[i]);
+        std::string key, param, type, value;
+        in >> key >> param >> type >> value;
+        if (param == name) return (type == "bool") ? (value == "true") : atof(value.c_str());
+    }
+    return default_value;
+}
+
+double distanceToSegment(double px, double py, double ax, double ay, double bx, double by) {
+    double dx = bx - ax, dy = by - ay;
+    double length2 = dx * dx + dy * dy;
+    double u = (length2 > 0) ? std::max(0.0, std::min(1.0, ((px - ax) * dx + (py - ay) * dy) / length2)) : 0;
+    return hypot(px - ax - u * dx, py - ay - u * dy);
+}
+
+Scenario generate(unsigned int seed, const std::vector<std::string>& param_lines) {
+
+    boost::random::mt19937 rng(seed);
+    boost::random::uniform_real_distribution<double> unit(0, 1);
+    Scenario scenario;
+    scenario.seed = seed;
+    scenario.param_lines = param_lines;
+    double radius_robot = paramValue(param_lines, "radius_robot", 0.5);
+
+    //! Goals one to four meters apart, the first one in front of the robot
+    int num_goals = boost::random::uniform_int_distribution<int>(1, MAX_GOALS)(rng);
+    double x = 0, y = 0, heading = 0;
+    for (int i = 0; i < num_goals; ++i) {
+        heading += (i == 0) ? (unit(rng) - 0.5) * M_PI / 2 : (unit(rng) - 0.5) * M_PI;
+        double distance = 1.0 + 3.0 * unit(rng);
+        Waypoint goal;
+        goal.x = x += distance * cos(heading);
+        goal.y = y += distance * sin(heading);
+        goal.yaw = heading + (unit(rng) - 0.5) * M_PI / 2;
+        scenario.goals.push_back(goal);
+    }
+
+    //! Obstacles around the path, but clear of the straight segments between start and goals
+    double x_min = 0, x_max = 0, y_min = 0, y_max = 0;
+    for (size_t i = 0; i < scenario.goals.size(); ++i) {
+        x_min = std::min(x_min, scenario.goals[i].x);
+        x_max = std::max(x_max, scenario.goals[i].x);
+        y_min = std::min(y_min, scenario.goals[i].y);
+        y_max = std::max(y_max, scenario.goals[i].y);
+    }
+    int num_obstacles = boost::random::uniform_int_distribution<int>(0, MAX_OBSTACLES)(rng);
+    for (int attempt = 0; attempt < 20 * MAX_OBSTACLES && (int)scenario.obstacles.size() < num_obstacles; ++attempt) {
+        Obstacle obstacle;
+        obstacle.x = x_min - 2.0 + (x_max - x_min + 4.0) * unit(rng);
+        obstacle.y = y_min - 2.0 + (y_max - y_min + 4.0) * unit(rng);
+        obstacle.radius = 0.05 + 0.45 * unit(rng);
+        double clearance = std::numeric_limits<double>::infinity();
+        double ax = 0, ay = 0;
+        for (size_t i = 0; i < scenario.goals.size(); ++i) {
+            clearance = std::min(clearance, distanceToSegment(obstacle.x, obstacle.y, ax, ay, scenario.goals[i].x, scenario.goals[i].y));
+            ax = scenario.goals[i].x;
+            ay = scenario.goals[i].y;
+        }
+        if (clearance > obstacle.radius + radius_robot + PATH_MARGIN) scenario.obstacles.push_back(obstacle);
+    }
+    return scenario;
+}
+
+//! Scan of the obstacles seen from pose (x, y, th)
+sensor_msgs::LaserScan::ConstPtr simulateScan(double x, double y, double th, const std::vector<Obstacle>& obstacles,
+                                              const ros::Time& stamp) {
+    sensor_msgs::LaserScan::Ptr scan(new sensor_msgs::LaserScan);
+    scan->header.stamp = stamp;
+    scan->header.frame_id = "/amigo/base_laser";
+    scan->angle_min = ANGLE_MIN;
+    scan->angle_increment = ANGLE_INCREMENT;
+    scan->angle_max = ANGLE_MIN + (NUM_READINGS - 1) * ANGLE_INCREMENT;
+    scan->scan_time = CYCLE_TIME;
+    scan->range_min = 0.05;
+    scan->range_max = RANGE_MAX;
+    scan->ranges.assign(NUM_READINGS, RANGE_MAX);
+    for (int j = 0; j < NUM_READINGS; ++j) {
+        double dx = cos(th + ANGLE_MIN + j * ANGLE_INCREMENT), dy = sin(th + ANGLE_MIN + j * ANGLE_INCREMENT);
+        for (size_t i = 0; i < obstacles.size(); ++i) {
+            //! Nearest intersection of the beam with the circle, if in front of the scanner
+            double px = obstacles[i].x - x, py = obstacles[i].y - y;
+            double along = px * dx + py * dy;
+            double d2 = px * px + py * py - along * along;
+            double r2 = obstacles[i].radius * obstacles[i].radius;
+            if (along <= 0 || d2 > r2) continue;
+            double range = along - sqrt(r2 - d2);
+            if (range > 0) scan->ranges[j] = std::min(scan->ranges[j], (float)range);
+        }
+    }
+    return scan;
+}
+
+void setParams(const std::string& name, const std::vector<std::string>& param_lines) {
+
+    ros::NodeHandle nh("~");
+    nh.setParam(name + "/simulation", true);
+    nh.setParam(name + "/kpi_period", 0.0);
+    for (size_t i = 0; i < param_lines.size(); ++i) {
+        std::istringstream in(param_lines[i]);
+        std::string key, param, type, value;
+        in >> key >> param >> type >> value;
+        if (type == "double") nh.setParam(name + "/" + param, atof(value.c_str()));
+        else if (type == "int") nh.setParam(name + "/" + param, atoi(value.c_str()));
+        else if (type == "bool") nh.setParam(name + "/" + param, value == "true");
+        else if (type == "string") nh.setParam(name + "/" + param, value);
+    }
+}
+
+//! Drive a planner named name through the goals of the scenario with an ideal base
+Result run(const Scenario& scenario, const std::string& name, double time_factor, std::ostream* trace = 0) {
+
+    setParams(name, scenario.param_lines);
+    CarrotPlanner planner(name);
+
+    //! Time allowed: driving at full speed, accelerating and turning towards each goal, times the factor
+    double max_vel = paramValue(scenario.param_lines, "max_vel_translation", 0.75);
+    double max_vel_rotation = paramValue(scenario.param_lines, "max_vel_rotation", 0.4);
+    double max_acc = paramValue(scenario.param_lines, "max_acc_translation", 0.15);
+    double radius_robot = paramValue(scenario.param_lines, "radius_robot", 0.5);
+    double still_timeout = paramValue(scenario.param_lines, "deadlock_timeout", 5.0);
+    double allowed_time = 0, ax = 0, ay = 0, heading = 0;
+    for (size_t i = 0; i < scenario.goals.size(); ++i) {
+        const Waypoint& goal = scenario.goals[i];
+        double leg_heading = atan2(goal.y - ay, goal.x - ax);
+        double turn = fabs(atan2(sin(leg_heading - heading), cos(leg_heading - heading))) +
+                      fabs(atan2(sin(goal.yaw - leg_heading), cos(goal.yaw - leg_heading)));
+        allowed_time += hypot(goal.x - ax, goal.y - ay) / max_vel + max_vel / max_acc + turn / max_vel_rotation;
+        ax = goal.x;
+        ay = goal.y;
+        heading = goal.yaw;
+    }
+    allowed_time = time_factor * allowed_time + TIME_SLACK;
+
+    Result result;
+    double x = 0, y = 0, th = 0, t_still = 0;
+    for (int k = 0; ; ++k) {
+        result.time = k * CYCLE_TIME;
+        ros::Time now(T_START + result.time);
+
+        //! Next goal once the current one is reached
+        const Waypoint& target = scenario.goals[result.goals_reached];
+        double dx = target.x - x, dy = target.y - y;
+        double angle_error = atan2(sin(target.yaw - th), cos(target.yaw - th));
+        if (hypot(dx, dy) < GOAL_TOLERANCE && fabs(angle_error) < GOAL_ANGLE_TOLERANCE) {
+            if (++result.goals_reached == (int)scenario.goals.size()) return result;
+            t_still = 0;
+            continue;
+        }
+        for (size_t i = 0; i < scenario.obstacles.size(); ++i) {
+            if (hypot(scenario.obstacles[i].x - x, scenario.obstacles[i].y - y) < scenario.obstacles[i].radius + radius_robot) {
+                result.outcome = OUTCOME_COLLISION;
+                return result;
+            }
+        }
+        if (result.time > allowed_time) {
+            result.outcome = OUTCOME_TIMEOUT;
+            return result;
+        }
+
+        planner.setLaserScan(simulateScan(x, y, th, scenario.obstacles, now));
+        geometry_msgs::PoseStamped goal;
+        goal.header.frame_id = "/amigo/base_link";
+        goal.pose.position.x = cos(th) * dx + sin(th) * dy;
+        goal.pose.position.y = -sin(th) * dx + cos(th) * dy;
+        goal.pose.orientation = tf::createQuaternionMsgFromYaw(angle_error);
+        planner.MoveToGoal(goal, now);
+        geometry_msgs::Twist cmd_vel = planner.getPublishedCommand();
+        if (trace) {
+            *trace << std::fixed << std::setprecision(3) << result.time << " " << x << " " << y << " " << th << " "
+                   << cmd_vel.linear.x << " " << cmd_vel.linear.y << " " << cmd_vel.angular.z << "\n";
+        }
+
+        //! The planner's own detectors, and standing still before the goal for another reason than a blocked path
+        if (planner.isOscillating()) {
+            result.outcome = OUTCOME_OSCILLATION;
+            return result;
+        }
+        bool still = fabs(cmd_vel.linear.x) < 1e-3 && fabs(cmd_vel.linear.y) < 1e-3 && fabs(cmd_vel.angular.z) < 1e-3;
+        t_still = still ? t_still + CYCLE_TIME : 0;
+        if (planner.isDeadlocked() || t_still > still_timeout) {
+            result.outcome = OUTCOME_DEADLOCK;
+            return result;
+        }
+
+        x += (cos(th) * cmd_vel.linear.x - sin(th) * cmd_vel.linear.y) * CYCLE_TIME;
+        y += (sin(th) * cmd_vel.linear.x + cos(th) * cmd_vel.linear.y) * CYCLE_TIME;
+        th += cmd_vel.angular.z * CYCLE_TIME;
+    }
+}
+
+//! Remove obstacles and goals one by one as long as the scenario fails in the same way
+Scenario shrink(const Scenario& failing, Outcome outcome, const std::string& name, double time_factor) {
+
+    Scenario scenario = failing;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = (int)scenario.obstacles.size() - 1; i >= 0; --i) {
+            Scenario candidate = scenario;
+            candidate.obstacles.erase(candidate.obstacles.begin() + i);
+            if (run(candidate, name, time_factor).outcome == outcome) {
+                scenario = candidate;
+                changed = true;
+            }
+        }
+        for (int i = (int)scenario.goals.size() - 1; i >= 0 && scenario.goals.size() > 1; --i) {
+            Scenario candidate = scenario;
+            candidate.goals.erase(candidate.goals.begin() + i);
+            if (run(candidate, name, time_factor).outcome == outcome) {
+                scenario = candidate;
+                changed = true;
+            }
+        }
+    }
+    return scenario;
+}
+
+bool writeScenario(const std::string& filename, const Scenario& scenario, const Result& result) {
+    std::ofstream out(filename.c_str());
+    if (!out) return false;
+    out << "# Carrot planner fuzz scenario " << scenario.seed << ": " << outcomeName(result.outcome) << " after "
+        << result.time << " [s], " << result.goals_reached << " of " << scenario.goals.size() << " goals reached\n";
+    out << "# Replay with: carrot_planner_fuzz --replay " << filename << " --trace\n";
+    out << "seed " << scenario.seed << "\n";
+    for (size_t i = 0; i < scenario.param_lines.size(); ++i) out << scenario.param_lines[i] << "\n";
+    out << std::setprecision(17);
+    for (size_t i = 0; i < scenario.obstacles.size(); ++i) {
+        out << "obstacle " << scenario.obstacles[i].x << " " << scenario.obstacles[i].y << " " << scenario.obstacles[i].radius << "\n";
+    }
+    for (size_t i = 0; i < scenario.goals.size(); ++i) {
+        out << "goal " << scenario.goals[i].x << " " << scenario.goals[i].y << " " << scenario.goals[i].yaw << "\n";
+    }
+    return out.good();
+}
+
+bool readScenario(const std::string& filename, Scenario& scenario) {
+    std::ifstream in(filename.c_str());
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "seed") {
+            fields >> scenario.seed;
+        } else if (key == "param") {
+            scenario.param_lines.push_back(line);
+        } else if (key == "obstacle") {
+            Obstacle obstacle;
+            fields >> obstacle.x >> obstacle.y >> obstacle.radius;
+            scenario.obstacles.push_back(obstacle);
+        } else if (key == "goal") {
+            Waypoint goal;
+            fields >> goal.x >> goal.y >> goal.yaw;
+            scenario.goals.push_back(goal);
+        }
+    }
+    return !scenario.goals.empty();
+}
+
+//! Work shared by the fuzzing threads
+struct Campaign {
+    int num_scenarios;
+    unsigned int seed;
+    double time_factor;
+    std::string output_dir;
+    std::vector<std::string> param_lines;
+    boost::atomic<int> next;
+    boost::mutex mutex;
+    int num_failures[OUTCOME_TIMEOUT + 1];
+};
+
+void fuzz(Campaign* campaign, int thread) {
+
+    std::ostringstream name;
+    name << "fuzz_" << thread;
+    for (int i = campaign->next++; i < campaign->num_scenarios; i = campaign->next++) {
+        Scenario scenario = generate(campaign->seed + i, campaign->param_lines);
+        Result result = run(scenario, name.str(), campaign->time_factor);
+        if (result.outcome != OUTCOME_OK) {
+            Scenario shrunk = shrink(scenario, result.outcome, name.str(), campaign->time_factor);
+            Result shrunk_result = run(shrunk, name.str(), campaign->time_factor);
+            std::ostringstream filename;
+            filename << campaign->output_dir << "/fuzz_" << scenario.seed << "_" << outcomeName(result.outcome) << ".txt";
+            bool written = writeScenario(filename.str(), shrunk, shrunk_result);
+
+            boost::mutex::scoped_lock lock(campaign->mutex);
+            ++campaign->num_failures[result.outcome];
+            printf("Scenario %u: %s after %.1f [s]; shrunk to %d obstacles and %d goals, %s %s\n", scenario.seed,
+                   outcomeName(result.outcome), result.time, (int)shrunk.obstacles.size(), (int)shrunk.goals.size(),
+                   written ? "saved as" : "cannot write", filename.str().c_str());
+        }
+    }
+}
+
+//! Parameter line of the scenario from name=value, typed by the form of the value
+std::string paramLine(const std::string& assignment) {
+    size_t equals = assignment.find('=');
+    std::string name = assignment.substr(0, equals);
+    std::string value = (equals == std::string::npos) ? "" : assignment.substr(equals + 1);
+    std::string type = "string";
+    char* end = 0;
+    if (value == "true" || value == "false") {
+        type = "bool";
+    } else if (!value.empty()) {
+        strtol(value.c_str(), &end, 10);
+        if (*end == 0) {
+            type = "int";
+        } else {
+            strtod(value.c_str(), &end);
+            if (*end == 0) type = "double";
+        }
+    }
+    return "param " + name + " " + type + " " + value;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    ros::init(argc, argv, "carrot_planner_fuzz", ros::init_options::AnonymousName | ros::init_options::NoSigintHandler);
+
+    Campaign campaign;
+    campaign.num_scenarios = 1000;
+    campaign.seed = 1;
+    campaign.time_factor = 3.0;
+    campaign.output_dir = ".";
+    campaign.next = 0;
+    std::fill(campaign.num_failures, campaign.num_failures + OUTCOME_TIMEOUT + 1, 0);
+    int num_threads = 0;
+    std::string replay;
+    bool trace = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--scenarios") && i + 1 < argc) campaign.num_scenarios = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) campaign.seed = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) num_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--output-dir") && i + 1 < argc) campaign.output_dir = argv[++i];
+        else if (!strcmp(argv[i], "--time-factor") && i + 1 < argc) campaign.time_factor = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--param") && i + 1 < argc) campaign.param_lines.push_back(paramLine(argv[++i]));
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc) replay = argv[++i];
+        else if (!strcmp(argv[i], "--trace")) trace = true;
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!ros::master::check()) {
+        fprintf(stderr, "No roscore running\n");
+        return 1;
+    }
+
+    //! Replay a saved scenario, optionally printing t x y th vx vy wz per cycle
+    if (!replay.empty()) {
+        Scenario scenario;
+        if (!readScenario(replay, scenario)) {
+            fprintf(stderr, "Cannot read scenario %s\n", replay.c_str());
+            return 1;
+        }
+        std::ostringstream cycles;
+        Result result = run(scenario, "replay", campaign.time_factor, trace ? &cycles : 0);
+        printf("%s", cycles.str().c_str());
+        printf("%s: %s after %.1f [s], %d of %d goals reached\n", replay.c_str(), outcomeName(result.outcome), result.time,
+               result.goals_reached, (int)scenario.goals.size());
+        return result.outcome == OUTCOME_OK ? 0 : 2;
+    }
+
+    if (num_threads <= 0) num_threads = std::max(1u, boost::thread::hardware_concurrency());
+    boost::thread_group threads;
+    for (int t = 0; t < num_threads; ++t) threads.create_thread(boost::bind(fuzz, &campaign, t));
+    threads.join_all();
+
+    int num_failed = 0;
+    printf("%d scenarios from seed %u:", campaign.num_scenarios, campaign.seed);
+    for (int outcome = OUTCOME_OSCILLATION; outcome <= OUTCOME_TIMEOUT; ++outcome) {
+        printf(" %d %s", campaign.num_failures[outcome], outcomeName((Outcome)outcome));
+        num_failed += campaign.num_failures[outcome];
+    }
+    printf("\n");
+    return num_failed == 0 ? 0 : 2;
+}
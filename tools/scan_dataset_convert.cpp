@@ -0,0 +1,80 @@
+//! Convert the laser scans of bag files into a memory-mapped scan dataset (scan_dataset.h) for scan_dataset_evaluate.
+//! The direction of each scan's goal is taken from the last velocity command before it, straight ahead if the robot
+//! was standing still.
+//!
+//!   scan_dataset_convert out.scans in1.bag [in2.bag ...] [--scan-topic /amigo/base_laser/scan]
+//!                        [--cmd-topic /amigo/base/references]
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <geometry_msgs/Twist.h>
+#include <sensor_msgs/LaserScan.h>
+#include "tue_carrot_planner/scan_dataset.h"
+
+int main(int argc, char** argv) {
+
+    std::string output, scan_topic("/amigo/base_laser/scan"), cmd_topic("/amigo/base/references");
+    std::vector<std::string> bags;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--scan-topic") && i + 1 < argc) scan_topic = argv[++i];
+        else if (!strcmp(argv[i], "--cmd-topic") && i + 1 < argc) cmd_topic = argv[++i];
+        else if (output.empty()) output = argv[i];
+        else bags.push_back(argv[i]);
+    }
+    if (output.empty() || bags.empty()) {
+        fprintf(stderr, "Usage: %s out.scans in.bag [in.bag ...] [--scan-topic topic] [--cmd-topic topic]\n", argv[0]);
+        return 1;
+    }
+
+    ScanDatasetWriter writer;
+    int num_readings = -1;
+    unsigned int num_skipped = 0;
+    for (size_t b = 0; b < bags.size(); ++b) {
+        rosbag::Bag bag;
+        try {
+            bag.open(bags[b], rosbag::bagmode::Read);
+        } catch (rosbag::BagException& e) {
+            fprintf(stderr, "Cannot open %s: %s\n", bags[b].c_str(), e.what());
+            return 1;
+        }
+
+        std::vector<std::string> topics;
+        topics.push_back(scan_topic);
+        topics.push_back(cmd_topic);
+        rosbag::View view(bag, rosbag::TopicQuery(topics));
+        double angle_goal = 0;
+        BOOST_FOREACH(const rosbag::MessageInstance& m, view) {
+            geometry_msgs::Twist::ConstPtr cmd_vel = m.instantiate<geometry_msgs::Twist>();
+            if (cmd_vel) {
+                double speed = sqrt(cmd_vel->linear.x * cmd_vel->linear.x + cmd_vel->linear.y * cmd_vel->linear.y);
+                angle_goal = (speed > 1e-3) ? atan2(cmd_vel->linear.y, cmd_vel->linear.x) : 0;
+                continue;
+            }
+            sensor_msgs::LaserScan::ConstPtr scan = m.instantiate<sensor_msgs::LaserScan>();
+            if (!scan) continue;
+
+            //! The file takes the number of readings of the first scan
+            if (num_readings < 0) {
+                num_readings = scan->ranges.size();
+                if (!writer.open(output, num_readings)) return 1;
+            }
+            if (!writer.append(*scan, angle_goal)) ++num_skipped;
+        }
+        printf("%s: %lu scans so far\n", bags[b].c_str(), (unsigned long)writer.numScans());
+    }
+
+    if (num_readings < 0) {
+        fprintf(stderr, "No scans on %s\n", scan_topic.c_str());
+        return 1;
+    }
+    if (num_skipped > 0) printf("Skipped %u scans with another number of readings than %d\n", num_skipped, num_readings);
+    if (!writer.close()) return 1;
+    printf("Wrote %s\n", output.c_str());
+    return 0;
+}
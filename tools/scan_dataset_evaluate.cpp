@@ -0,0 +1,170 @@
+//! Run the clear-line check of the carrot planner over recorded scan datasets (scan_dataset.h) for a range of virtual
+//! wall distances, to see how often the robots would have been blocked with each setting. The scans are memory-mapped
+//! and evaluated in parallel.
+//!
+//!   scan_dataset_evaluate in1.scans [in2.scans ...] [--dist-vir-wall 0.5,0.65,0.8] [--radius 0.5] [--threads 0]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/thread.hpp>
+#include "tue_carrot_planner/carrot_planner.h"
+#include "tue_carrot_planner/scan_dataset.h"
+
+namespace {
+
+//! Gaps between scans longer than this are recording breaks, not blocked time
+const double MAX_SCAN_INTERVAL = 1.0;
+
+struct Result {
+    unsigned long num_blocked;
+    unsigned long num_episodes;
+    double blocked_time;
+    Result() : num_blocked(0), num_episodes(0), blocked_time(0) {}
+};
+
+//! Distance from the robot edge to the nearest valid reading, for a contiguous part of a dataset
+struct ClearancePart {
+    const ScanDatasetReader* dataset;
+    boost::uint64_t first, last;
+    double radius_robot;
+    float* clearance;
+
+    void operator()() const {
+        int num_readings = dataset->numReadings();
+        for (boost::uint64_t i = first; i < last; ++i) {
+            const float* ranges = dataset->ranges(i);
+            float range_max = dataset->rangeMax(i);
+            float nearest = std::numeric_limits<float>::infinity();
+            for (int j = 0; j < num_readings; ++j) {
+                bool valid = (ranges[j] > 0.001f) & (ranges[j] <= range_max);
+                nearest = std::min(nearest, valid ? ranges[j] : std::numeric_limits<float>::infinity());
+            }
+            clearance[i] = nearest - radius_robot;
+        }
+    }
+};
+
+//! Clear-line check of every scan towards its goal, batched over runs of scans with the same geometry
+void evaluate(const ScanDatasetReader& dataset, double dist_wall, double radius_robot, int num_threads, bool* path_free,
+              std::vector<double>& angle_goals) {
+
+    boost::uint64_t n = dataset.numScans();
+    angle_goals.resize(n);
+    for (boost::uint64_t i = 0; i < n; ++i) angle_goals[i] = dataset.angleGoal(i);
+
+    boost::uint64_t first = 0;
+    while (first < n) {
+        boost::uint64_t last = first + 1;
+        while (last < n && dataset.angleMin(last) == dataset.angleMin(first) &&
+               dataset.angleIncrement(last) == dataset.angleIncrement(first)) ++last;
+        CarrotPlanner::isClearLine(dataset.ranges(first), last - first, dataset.numReadings(), dataset.angleMin(first),
+                                   dataset.angleIncrement(first), &angle_goals[first], dist_wall, radius_robot,
+                                   path_free + first, num_threads);
+        first = last;
+    }
+}
+
+double percentile(std::vector<float> values, double p) {
+    if (values.empty()) return std::numeric_limits<double>::quiet_NaN();
+    size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    std::vector<std::string> files;
+    std::vector<double> dist_walls;
+    double radius_robot = 0.5;
+    int num_threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--dist-vir-wall") && i + 1 < argc) {
+            std::istringstream in(argv[++i]);
+            std::string value;
+            while (std::getline(in, value, ',')) dist_walls.push_back(atof(value.c_str()));
+        } else if (!strcmp(argv[i], "--radius") && i + 1 < argc) {
+            radius_robot = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        fprintf(stderr, "Usage: %s in.scans [in.scans ...] [--dist-vir-wall 0.5,0.65,0.8] [--radius 0.5] [--threads 0]\n", argv[0]);
+        return 1;
+    }
+    if (dist_walls.empty()) dist_walls.push_back(0.65);
+    if (num_threads <= 0) num_threads = std::max(1u, boost::thread::hardware_concurrency());
+
+    std::vector<Result> results(dist_walls.size());
+    std::vector<float> clearances;
+    unsigned long num_scans = 0;
+    double total_time = 0;
+    std::vector<double> angle_goals;
+    for (size_t f = 0; f < files.size(); ++f) {
+        ScanDatasetReader dataset;
+        if (!dataset.open(files[f])) return 1;
+        boost::uint64_t n = dataset.numScans();
+        if (n == 0) continue;
+        num_scans += n;
+
+        //! Time each scan stands for, until the next one
+        std::vector<double> interval(n, 0);
+        for (boost::uint64_t i = 0; i + 1 < n; ++i) {
+            double dt = dataset.stamp(i + 1) - dataset.stamp(i);
+            interval[i] = (dt > 0 && dt < MAX_SCAN_INTERVAL) ? dt : 0;
+            total_time += interval[i];
+        }
+
+        boost::scoped_array<bool> path_free(new bool[n]);
+        for (size_t k = 0; k < dist_walls.size(); ++k) {
+            evaluate(dataset, dist_walls[k], radius_robot, num_threads, path_free.get(), angle_goals);
+            for (boost::uint64_t i = 0; i < n; ++i) {
+                if (path_free[i]) continue;
+                ++results[k].num_blocked;
+                results[k].blocked_time += interval[i];
+                results[k].num_episodes += (i == 0 || path_free[i - 1] || interval[i - 1] == 0);
+            }
+        }
+
+        //! Clearance, split over the threads like the clear-line batch
+        size_t offset = clearances.size();
+        clearances.resize(offset + n);
+        boost::thread_group threads;
+        boost::uint64_t first = 0;
+        for (int t = 0; t < num_threads; ++t) {
+            ClearancePart part;
+            part.dataset = &dataset;
+            part.first = first;
+            part.last = first + (n - first) / (num_threads - t);
+            part.radius_robot = radius_robot;
+            part.clearance = &clearances[offset];
+            threads.create_thread(part);
+            first = part.last;
+        }
+        threads.join_all();
+    }
+
+    printf("%lu scans, %.1f [s], robot radius %.3f [m]\n\n", num_scans, total_time, radius_robot);
+    printf("dist_vir_wall [m]   blocked scans   blocked [%%]   blocked time [s]   episodes\n");
+    for (size_t k = 0; k < dist_walls.size(); ++k) {
+        printf("%17.3f   %13lu   %11.2f   %16.1f   %8lu\n", dist_walls[k], results[k].num_blocked,
+               num_scans > 0 ? 100.0 * results[k].num_blocked / num_scans : 0.0, results[k].blocked_time, results[k].num_episodes);
+    }
+    unsigned long num_contact = 0;
+    for (size_t i = 0; i < clearances.size(); ++i) num_contact += clearances[i] < 0;
+    printf("\nclearance [m]: 1%% %.3f, 5%% %.3f, median %.3f; %lu scans with a reading within the radius\n",
+           percentile(clearances, 0.01), percentile(clearances, 0.05), percentile(clearances, 0.5), num_contact);
+    return 0;
+}
@@ -0,0 +1,41 @@
+//! Stand-in for a laser driver that writes its scans into a shared-memory ring: relays a scan topic into the ring, so
+//! the ring ingest of the carrot planner can be run against a simulator or a bag.
+//!
+//!   rosrun tue_carrot_planner scan_ring_relay scan:=/amigo/base_laser/scan _scan_ring:=/amigo_base_laser
+//!
+//! and start the planner with the same ~scan_ring parameter.
+
+#include <algorithm>
+#include <ros/ros.h>
+#include <sensor_msgs/LaserScan.h>
+#include "tue_carrot_planner/scan_ring.h"
+
+namespace {
+
+ScanRingWriter writer;
+std::string ring_name;
+int num_slots, max_readings;
+
+void scanCallBack(const sensor_msgs::LaserScan::ConstPtr& scan) {
+
+    //! Without a given size, the ring is created to fit the first scan
+    if (!writer.write(*scan) && writer.numWritten() == 0) {
+        if (writer.create(ring_name, num_slots, std::max(max_readings, (int)scan->ranges.size()))) writer.write(*scan);
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    ros::init(argc, argv, "scan_ring_relay");
+    ros::NodeHandle nh, private_nh("~");
+    private_nh.param("scan_ring", ring_name, std::string("/tue_carrot_planner_scan"));
+    private_nh.param("num_slots", num_slots, 4);
+    private_nh.param("max_readings", max_readings, 0);
+    if (max_readings > 0 && !writer.create(ring_name, num_slots, max_readings)) return 1;
+
+    ros::Subscriber sub = nh.subscribe("scan", 10, scanCallBack, ros::TransportHints().tcpNoDelay());
+    ros::spin();
+    return 0;
+}